@@ -29,6 +29,7 @@
 #include "bldr.h"
 #include "rsa.h"
 #include "sha1.h"
+#include "lzx.h"
 
 #define MIN_BIOS_SIZE 0x40000                                                    // Min bios file/rom size in bytes
 #define MAX_BIOS_SIZE 0x100000                                                   // Max bios file/rom size in bytes
@@ -122,11 +123,16 @@ typedef struct BIOS_BUILD_PARAMS {
 	uint8_t* kernel_data;
 	uint8_t* eeprom_key;
 	uint8_t* cert_key;
+	uint8_t* checkpoint;
 	uint32_t preldr_size;
 	uint32_t bldrSize; 
 	uint32_t init_tbl_size;
 	uint32_t kernel_size;
 	uint32_t kernel_data_size;
+	uint32_t threads;
+	uint32_t checkpoint_size;
+	LZX_COMPRESSION_PARAMS lzx_params;
+	bool incremental;
 	bool bfm;
 	bool hackinittbl;
 	bool hacksignature;
@@ -204,6 +210,10 @@ public:
 	// returns 0 if successful,
 	int decompressKrnl();
 
+	// decompress part of the kernel image from the bios; decoding stops at the end of the range.
+	// returns 0 if successful,
+	int decompressKrnlRange(uint32_t offset, uint32_t size, uint8_t* dest);
+
 	// preldr decrypt preldr public key.
 	int preldrDecryptPublicKey();
 
@@ -221,4 +231,10 @@ void bios_free_build_params(BIOS_BUILD_PARAMS* params);
 int bios_check_size(const uint32_t size);
 int bios_replicate_data(uint32_t from, uint32_t to, uint8_t* buffer, uint32_t buffersize);
 
+// find the sb key that decrypts the 2BL of a bios. only the 2BL boot params are decrypted for each key.
+// keys: key_count 16 byte sb keys, back to back.
+// threads: 0 = number of processors.
+// returns the index of the key, -1 if no key decrypts the 2BL.
+int bios_find_bldr_key(const uint8_t* data, const uint32_t size, const uint8_t* keys, const uint32_t key_count, uint32_t threads);
+
 #endif // !XB_BIOS_H
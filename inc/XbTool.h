@@ -28,6 +28,7 @@
 #include "Bios.h"
 #include "Mcpx.h"
 #include "cli_tbl.h"
+#include "lzx.h"
 
 enum XB_CLI_COMMAND : CLI_COMMAND {
 	CMD_INFO = CLI_COMMAND_START_INDEX,
@@ -84,7 +85,12 @@ enum XB_CLI_SWITCH : CLI_SWITCH {
 	SW_HELP_ALL,
 	SW_WORKING_DIRECTORY,
 	SW_OFFSET,
-	SW_XCODES
+	SW_XCODES,
+	SW_THREADS,
+	SW_MATCH_FINDER,
+	SW_LEVEL,
+	SW_CHECKPOINT,
+	SW_KEYRING
 };
 
 typedef struct {
@@ -93,6 +99,9 @@ typedef struct {
 	uint32_t simSize;
 	uint32_t base;
 	uint32_t offset;
+	uint32_t threads;
+	uint32_t level;
+	LZX_COMPRESSION_PARAMS lzx_params;
 	uint8_t* bldr_key;
 	uint8_t* kernel_key;
 	MCPX mcpx;
@@ -113,6 +122,9 @@ typedef struct {
 	const char* settings_file;
 	const char* working_directory_path;
 	const char* xcodes_file;
+	const char* match_finder;
+	const char* checkpoint_file;
+	const char* keyring_dir;
 } XbToolParameters;
 
 /* Command functions */
@@ -133,11 +145,14 @@ int encodeX86();
 int dumpCoffPeImg();
 int compressFile();
 int decompressFile();
+int compressStream();
+int decompressStream();
 
 void init_parameters(XbToolParameters* params);
 void free_parameters(XbToolParameters* params);
 int inject_xcodes(uint8_t* data, uint32_t size, uint8_t* xcodes, uint32_t xcodesSize);
 uint8_t* load_init_tbl_file(uint32_t* size, uint32_t* base);
+int find_keyring_key(const uint8_t* data, const uint32_t size);
 
 /* BIOS print functions */
 void printBldrInfo(Bios* bios);
@@ -25,6 +25,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+// file name for stdin / stdout
+#define FILE_STDIO_NAME "-"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,6 +63,36 @@ int deleteFile(const char* filename);
 // returns 0 if successful, 1 otherwise.
 int getFileSize(FILE* file, uint32_t* fileSize);
 
+// move console output to stderr so stdout only carries data written with openFileFd(FILE_STDIO_NAME, true).
+// returns 0 if successful, 1 otherwise.
+int redirectStdout();
+
+// open a file descriptor for streaming.
+// filename: the path to the file. FILE_STDIO_NAME opens stdin or stdout.
+// writeAccess: open for writing (create / truncate), otherwise for reading.
+// returns the fd if successful, -1 otherwise.
+int openFileFd(const char* filename, bool writeAccess);
+
+// close a file descriptor opened with openFileFd. stdin and stdout are left open.
+void closeFileFd(int fd);
+
+// read from a file descriptor until bytesToRead bytes are read or end of file.
+// returns the number of bytes read, -1 on error.
+int readFd(int fd, void* ptr, const uint32_t bytesToRead);
+
+// write to a file descriptor.
+// returns 0 if successful, 1 otherwise.
+int writeFd(int fd, const void* ptr, const uint32_t bytesToWrite);
+
+// called by listDir for each file.
+// path: the directory and file name joined.
+// name: the file name.
+typedef void (*LIST_DIR_PROC)(const char* path, const char* name, void* arg);
+
+// call proc for every regular file in a directory.
+// returns 0 if successful, 1 otherwise.
+int listDir(const char* dirname, LIST_DIR_PROC proc, void* arg);
+
 #ifdef __cplusplus
 };
 #endif
@@ -29,6 +29,7 @@ const char HELP_STR_LIST[] = "Dump BIOS infomation. params, sizes, signatures, k
 
 const char HELP_STR_BUILD[] = "Build a BIOS from a preldr, 2BL, kernel, section data, init table.\n" \
 "* The romsize dictates the amount of space available for the BIOS image.\n" \
+"* A decompressed kernel image is compressed before it is added.\n" \
 "* The BIOS image is replicated upto the binsize";
 
 const char HELP_STR_SPLIT[] = "Split a BIOS into banks. Eg: bios.bin 1mb -> bios.bin 4x 256kb.\n" \
@@ -51,6 +52,7 @@ const char HELP_STR_INFO[] = "Display licence, version and author information.";
 const char HELP_STR_REPLICATE[] = "Replicate a BIOS image upto a specified size.";
 const char HELP_STR_COMPRESS_FILE[] = "Compress a file using the lzx algorithm.";
 const char HELP_STR_DECOMPRESS_FILE[] = "Decompress a file using the lzx algorithm.";
+const char HELP_STR_STDIO_STREAM[] = "Use - as the path to stream from stdin or to stdout.";
 const char HELP_STR_DISASM[] = "Disasm x86 instructions from a file.";
 
 const char HELP_STR_VALID_ROM_SIZES[] = "valid opts: 256, 512, 1024.";
@@ -62,6 +64,9 @@ const char HELP_STR_MCPX_ROM[] = "-mcpx <path>\t\t- path to the mcpx file. Shoul
 const char HELP_STR_RC4_KEY[] = " <path> " \
 "\t- path to the %s key file. Should be 16 bytes";
 
+const char HELP_STR_KEYRING[] = "-keyring <dir>\t\t- directory of 16 byte sb key files\n" \
+"\t\t\t- Finds the key that decrypts the 2BL when -mcpx and -key-bldr are not given.";
+
 const char HELP_STR_RC4_ENC[] = "\t\t- dont encrypt/decrypt the %s";
 
 const char HELP_STR_PARAM_EEPROM_KEY[] =	"-eepromkey <path>  eeprom key file";
@@ -92,6 +97,11 @@ const char HELP_STR_PARAM_HACK_SIGNATURE[] ="-hacksignature   - hack boot signat
 const char HELP_STR_PARAM_WDIR[] =          "-dir             - working directory";
 const char HELP_STR_PARAM_UPDATE_BOOT_PARAMS[] =  "-nobootparams    - dont update 2BL boot params";
 const char HELP_STR_PARAM_RESTORE_BOOT_PARAMS[] = "-nobootparams    - dont restore 2BL boot params (FBL BIOSes only)";
+const char HELP_STR_PARAM_THREADS[] =		"-threads <num>   - compression threads; 0 = all processors. default is 1";
+const char HELP_STR_PARAM_DECOMPRESS_THREADS[] = "-threads <num>   - 1 = single thread; default 0, two threads on big files";
+const char HELP_STR_PARAM_MATCH_FINDER[] =	"-mf <bt|hc|ht>   - match finder (tree, hash chain, hash table); default bt";
+const char HELP_STR_PARAM_LEVEL[] =		"-level <1-5>     - 1 greedy, 2 lazy, 3 lazy2, 4 optimal, 5 ultra; default 4";
+const char HELP_STR_PARAM_CHECKPOINT[] =	"-checkpoint <path> - kernel checkpoint; only recompress changed chunks";
 const char HELP_STR_PARAM_BRANCH[] =		"-branch          - take unbranchable jumps";
 
 #endif // XB_BIOS_TOOL_COMMANDS_H
\ No newline at end of file
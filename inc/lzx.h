@@ -42,6 +42,12 @@
 #define LZX_MAX_MAIN_TREE_ELEMENTS 700
 #define MAIN_TREE_TABLE_BITS 10
 #define SECONDARY_LEN_TREE_TABLE_BITS 8
+// first level plus the worst case second level: a subtable of 2^d entries needs at least d + 1 codes.
+#define MAIN_TREE_TABLE_SIZE ((1 << MAIN_TREE_TABLE_BITS) + LZX_MAX_MAIN_TREE_ELEMENTS * 64 / 7)
+#define SECONDARY_LEN_TREE_TABLE_SIZE ((1 << SECONDARY_LEN_TREE_TABLE_BITS) + LZX_NUM_SECONDARY_LEN * 256 / 9)
+#define LZX_MAX_TREE_LEN 16
+#define LZX_MAX_PRETREE_LEN 15
+#define LZX_MAX_ALIGNED_TREE_LEN 7
 
 // error codes
 #define LZX_ERROR_SUCCESS 0
@@ -49,6 +55,23 @@
 #define LZX_ERROR_BUFFER_OVERFLOW 4
 #define LZX_ERROR_OUT_OF_MEMORY 5
 #define LZX_ERROR_INVALID_DATA 6
+#define LZX_ERROR_IO 7
+
+// match finders
+#define LZX_MATCH_FINDER_BINARY_TREE 0  // binary search trees; best ratio. (default)
+#define LZX_MATCH_FINDER_HASH_CHAIN 1   // hash chains; faster, slightly worse ratio.
+#define LZX_MATCH_FINDER_HASH_TABLE 2   // single slot hash table; fastest, worst ratio.
+
+// compression levels
+#define LZX_LEVEL_GREEDY 1              // greedy parse; fastest.
+#define LZX_LEVEL_LAZY 2                // lazy parse; one step look ahead.
+#define LZX_LEVEL_LAZY2 3               // lazy parse; two step look ahead.
+#define LZX_LEVEL_OPTIMAL 4             // optimal parse. (default)
+#define LZX_LEVEL_ULTRA 5               // multi-pass optimal parse priced with the previous pass's trees; best ratio.
+
+// block splitting defaults
+#define LZX_DEFAULT_MAX_BLOCK_SPLITS 4          // cheap splits before a split must save 1/64 of the block.
+#define LZX_DEFAULT_SPLIT_MIN_GAIN 0            // estimated bits a split must save.
 
 // block type
 #define LZX_BLOCK_TYPE_INVALID 0
@@ -63,31 +86,31 @@ typedef struct _LZX_BLOCK {
 
 typedef struct {
     uint8_t* mem_window;
+    uint8_t* window_buffer;
     uint32_t window_size;
     uint32_t window_mask;
     uint32_t last_matchpos_offset[LZX_NUM_REPEATED_OFFSETS];
-    short main_tree_table[1 << MAIN_TREE_TABLE_BITS];
-    short secondary_len_tree_table[1 << SECONDARY_LEN_TREE_TABLE_BITS];
+    uint32_t main_tree_table[MAIN_TREE_TABLE_SIZE];
+    uint32_t secondary_len_tree_table[SECONDARY_LEN_TREE_TABLE_SIZE];
     uint8_t main_tree_len[LZX_MAX_MAIN_TREE_ELEMENTS];
     uint8_t secondary_len_tree_len[LZX_NUM_SECONDARY_LEN];
     uint8_t pad1[2];
     uint8_t num_position_slots;
     char aligned_table[1 << LZX_ALIGNED_TABLE_BITS];
     uint8_t aligned_len[LZX_ALIGNED_NUM_ELEMENTS];
-    short main_tree_left_right[LZX_MAX_MAIN_TREE_ELEMENTS * 4];
-    short secondary_len_tree_left_right[LZX_NUM_SECONDARY_LEN * 4];
     const uint8_t* input_curpos;
     const uint8_t* end_input_pos;
     uint8_t* output_buffer;
-    uint8_t* input_buffer;
     long position_at_start;
     uint8_t main_tree_prev_len[LZX_MAX_MAIN_TREE_ELEMENTS];
     uint8_t secondary_len_tree_prev_len[LZX_NUM_SECONDARY_LEN];
     char bitcount;
     bool first_time_this_group;
     bool error_condition;
-    uint32_t bitbuf;
+    bool linear_window;
+    uint64_t bitbuf;
     long pos;
+    long frame_residue;
     uint32_t current_file_size;
     uint32_t instr_pos;
     uint32_t num_cfdata_frames;
@@ -105,14 +128,27 @@ typedef struct {
 } DECISION_NODE;
 
 typedef struct {
+    int match_finder;
+    int level;
+    int max_block_splits;
+    int split_min_gain;
+    bool e8_translation;
+} LZX_COMPRESSION_PARAMS;
+
+typedef struct {
+    uint32_t bufpos;
+    uint8_t main_tree_len[LZX_MAX_MAIN_TREE_ELEMENTS];
+    uint8_t secondary_tree_len[LZX_NUM_SECONDARY_LEN];
+} LZX_PASS_COST;
+
+typedef struct _ENCODER_CONTEXT {
     uint8_t* mem_window;
     uint32_t window_size;
     uint32_t* tree_root;
     uint32_t* left;
     uint32_t* right;
-    uint32_t bitbuf;
+    uint64_t bitbuf;
     char bitcount;
-    char depth;
     bool output_overflow;
     uint32_t literals;
     uint32_t distances;
@@ -132,6 +168,10 @@ typedef struct {
     uint32_t num_position_slots;
     uint32_t file_size_for_translation;
     uint8_t num_block_splits;
+    uint8_t max_block_splits;
+    uint32_t split_min_gain;
+    uint16_t* split_hist;
+    bool e8_translation;
     uint8_t first_block;
     bool need_to_recalc_stats;
     bool first_time_this_group;
@@ -142,27 +182,24 @@ typedef struct {
     uint8_t* input_ptr;
     long input_left;
     uint32_t instr_pos;
-    uint16_t* tree_freq;
-    uint16_t* tree_sortptr;
     uint8_t* len;
-    short tree_heap[LZX_MAX_MAIN_TREE_ELEMENTS + 2];
-    uint16_t tree_leftright[2 * (2 * LZX_MAX_MAIN_TREE_ELEMENTS - 1)];
-    uint16_t tree_len_cnt[17];
-    short tree_heapsize;
-    int tree_n;
+    uint32_t tree_keys[LZX_MAX_MAIN_TREE_ELEMENTS];
+    uint32_t tree_weight[2][2 * LZX_MAX_MAIN_TREE_ELEMENTS];
+    uint8_t tree_is_leaf[LZX_MAX_TREE_LEN][2 * LZX_MAX_MAIN_TREE_ELEMENTS];
+    uint16_t tree_len_cnt[LZX_MAX_TREE_LEN + 1];
     uint32_t next_tree_create;
     uint32_t last_literals;
     uint32_t last_distances;
     DECISION_NODE* decision_node;
     uint8_t main_tree_len[LZX_MAX_MAIN_TREE_ELEMENTS + 1];
     uint8_t secondary_tree_len[LZX_NUM_SECONDARY_LEN + 1];
-    uint16_t main_tree_freq[LZX_MAX_MAIN_TREE_ELEMENTS * 2];
+    uint16_t main_tree_freq[LZX_MAX_MAIN_TREE_ELEMENTS];
     uint16_t main_tree_code[LZX_MAX_MAIN_TREE_ELEMENTS];
     uint8_t main_tree_prev_len[LZX_MAX_MAIN_TREE_ELEMENTS + 1];
-    uint16_t secondary_tree_freq[LZX_NUM_SECONDARY_LEN * 2];
+    uint16_t secondary_tree_freq[LZX_NUM_SECONDARY_LEN];
     uint16_t secondary_tree_code[LZX_NUM_SECONDARY_LEN];
     uint8_t secondary_tree_prev_len[LZX_NUM_SECONDARY_LEN + 1];
-    uint16_t aligned_tree_freq[LZX_ALIGNED_NUM_ELEMENTS * 2];
+    uint16_t aligned_tree_freq[LZX_ALIGNED_NUM_ELEMENTS];
     uint16_t aligned_tree_code[LZX_ALIGNED_NUM_ELEMENTS];
     uint8_t aligned_tree_len[LZX_ALIGNED_NUM_ELEMENTS];
     uint8_t aligned_tree_prev_len[LZX_ALIGNED_NUM_ELEMENTS];
@@ -174,6 +211,28 @@ typedef struct {
     uint8_t* output_buffer;
     uint32_t output_buffer_size;
     uint32_t output_buffer_block_count;
+    uint8_t* output_buffer_base;
+    uint32_t output_buffer_capacity;
+    bool output_buffer_grow;
+    int output_fd;
+    int output_error;
+    int match_finder;
+    int level;
+    long (*findmatch)(struct _ENCODER_CONTEXT* context, long buf_pos);
+    // end_pos is the oldest position still in the window; the hash finders ignore it.
+    void (*insert_node)(struct _ENCODER_CONTEXT* context, long buf_pos, long end_pos);
+    void (*remove_node)(struct _ENCODER_CONTEXT* context, long buf_pos, uint32_t end_pos);
+    int (*match_len)(const uint8_t* a, const uint8_t* b, int len, int limit);
+    LZX_PASS_COST* pass_costs;
+    uint32_t pass_cost_count;
+    uint32_t pass_cost_capacity;
+    uint32_t pass_cost_index;
+    uint32_t pass_cost_next_bufpos;
+    bool pass_cost_dirty;
+    bool pass_recording;
+    LZX_PASS_COST* pass_record;
+    uint32_t pass_record_count;
+    uint32_t pass_record_capacity;
 } ENCODER_CONTEXT;
 
 #ifdef __cplusplus
@@ -186,27 +245,90 @@ LZX_DECODER_CONTEXT* lzx_create_decompression();
 /* Destroy lzx decoder */
 void lzx_destroy_decompression(LZX_DECODER_CONTEXT* context);
 
+/* Reset lzx decoder to the start of a new stream. the window is reused */
+void lzx_reset_decompression(LZX_DECODER_CONTEXT* context);
+
 /* Decompress block */
 int lzx_decompress_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint32_t src_size, uint8_t* dest, uint32_t* bytes_decompressed);
 
 /* Decompress next block */
 int lzx_decompress_next_block(LZX_DECODER_CONTEXT* context, const uint8_t** src, uint32_t* src_size, uint8_t** dest, uint32_t* bytes_decompressed);
 
+/* Get the decompressed size of the input buffer from its frame headers
+ Nothing is decoded; each header is checked to lie within the input buffer.
+ src: Input buffer
+ src_size: Input buffer size
+ decompressed_size: Returns the total size of the frames
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_get_decompressed_size(const uint8_t* src, const uint32_t src_size, uint32_t* decompressed_size);
+
+/* Get the output buffer size lzx_decompress needs
+ decompressed_size: Size from lzx_get_decompressed_size
+ returns the size to pre-allocate so lzx_decompress and lzx_decompress_mt never reallocate the output buffer */
+uint32_t lzx_decompress_bound(const uint32_t decompressed_size);
+
 /* Decompress the input buffer block by block into the output buffer
+ The frames are decoded in place and the output buffer is the window, so nothing is copied.
  src: Input buffer
  src_size: Input buffer size
  dest: Address of the output buffer. pre-allocate or null buffer.
  dest_size: Output buffer size; returns the output buffer size. if output buffer is pre-allocated, this should be the size of the pre-allocated buffer.
+    the buffer is grown to lzx_decompress_bound() of the decompressed size.
  decompressed_size: Returns the decompressed size.
  returns 0 on SUCCESS, otherwise LZX_ERROR */
 int lzx_decompress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size);
 
-/* Create lzx encoder */
-ENCODER_CONTEXT* lzx_create_compression(uint8_t* dest);
+/* Decompress the input buffer on two threads into the output buffer
+ One thread decodes the frames into literal and match tokens while the other copies the
+ previous batch of tokens into the output. The output buffer holds the whole stream.
+ src, src_size, dest, dest_size, decompressed_size: same as lzx_decompress
+ threads: 0 = use the pipeline when there is more than one processor. 1 = lzx_decompress
+ small inputs always use lzx_decompress, and a stream the pipeline fails on is retried with lzx_decompress
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_decompress_mt(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size, uint32_t threads);
+
+/* Decompress the input buffer block by block into the output buffer using a caller owned decoder
+ The decoder is reset before use, so it can be kept and reused for many streams.
+ context: lzx decoder
+ src, src_size, dest, dest_size, decompressed_size: same as lzx_decompress
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_decompress_ctx(LZX_DECODER_CONTEXT* context, const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size);
+
+/* Decompress a stream of frames from one file descriptor to another
+ Frames are read and written one at a time; memory use is the window plus one frame.
+ in_fd: Input file descriptor
+ out_fd: Output file descriptor
+ compressed_size: Returns the number of bytes read; can be NULL
+ decompressed_size: Returns the number of bytes written; can be NULL
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_decompress_fd(int in_fd, int out_fd, uint32_t* compressed_size, uint32_t* decompressed_size);
+
+/* Decompress a byte range of the input buffer
+ The stream is decoded from the start in the decoder's window and decoding stops once the range is filled,
+ so only the frames up to the end of the range are decoded and only the range is written.
+ src: Input buffer
+ src_size: Input buffer size
+ offset: Decompressed offset of the range
+ size: Size of the range
+ dest: Output buffer; at least size bytes
+ returns 0 on SUCCESS, LZX_ERROR_BUFFER_OVERFLOW if the range is past the end of the stream, otherwise LZX_ERROR */
+int lzx_decompress_range(const uint8_t* src, const uint32_t src_size, const uint32_t offset, const uint32_t size, uint8_t* dest);
+
+/* Initialize compression parameters to the defaults */
+void lzx_init_compression_params(LZX_COMPRESSION_PARAMS* params);
+
+/* Create lzx encoder
+ dest: Output buffer; size it with lzx_compress_bound()
+ params: Compression parameters; NULL for the defaults */
+ENCODER_CONTEXT* lzx_create_compression(uint8_t* dest, const LZX_COMPRESSION_PARAMS* params);
 
 /* Destroy lzx encoder */
 void lzx_destroy_compression(ENCODER_CONTEXT* context);
 
+/* Reset lzx encoder to the start of a new stream. the trees, window and buffers are reused
+ dest: Output buffer */
+void lzx_reset_compression(ENCODER_CONTEXT* context, uint8_t* dest);
+
 /* Compress block */
 int lzx_compress_block(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t bytes_read);
 
@@ -216,13 +338,84 @@ int lzx_compress_next_block(ENCODER_CONTEXT* context, const uint8_t** src, uint3
 /* Flush lzx encoder */
 void lzx_flush_compression(ENCODER_CONTEXT* context);
 
+/* Get the largest compressed size of an input buffer
+ src_size: Input buffer size
+ returns the size to pre-allocate so lzx_compress never runs out of output buffer */
+uint32_t lzx_compress_bound(const uint32_t src_size);
+
 /* Compress the input buffer block by block into the output buffer
+ src: Input buffer
+ src_size: Input buffer size
+ dest: Address of the output buffer. pre-allocate or null buffer. a null buffer is allocated and grown as needed.
+ dest_size: Output buffer size; returns the output buffer size. if output buffer is pre-allocated, this should be the size of the pre-allocated buffer. can be NULL
+ compressed_size: Returns the compressed size
+ params: Compression parameters; NULL for the defaults
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_compress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params);
+
+/* Compress the input buffer block by block into the output buffer using a caller owned encoder
+ The encoder is reset before use, so it can be kept and reused for many streams.
+ context: lzx encoder; the compression parameters are the ones it was created with
+ src, src_size, dest, dest_size, compressed_size: same as lzx_compress
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_compress_ctx(ENCODER_CONTEXT* context, const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size);
+
+/* Compress from one file descriptor to another
+ The input is read in chunks and each frame is written as soon as it is produced;
+ memory use is the window plus one frame.
+ in_fd: Input file descriptor
+ out_fd: Output file descriptor
+ params: Compression parameters; NULL for the defaults
+ src_size: Returns the number of bytes read; can be NULL
+ compressed_size: Returns the number of bytes written; can be NULL
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_compress_fd(int in_fd, int out_fd, const LZX_COMPRESSION_PARAMS* params, uint32_t* src_size, uint32_t* compressed_size);
+
+/* Compress the input buffer on multiple threads into the output buffer
+ The input is split into segments; each segment is primed with the preceding window of input and
+ compressed on its own thread. The frames are stitched into a single stream.
  src: Input buffer
  src_size: Input buffer size
  dest: Address of the output buffer. pre-allocate or null buffer
+ dest_size: Output buffer size; same as lzx_compress
+ compressed_size: Returns the compressed size
+ params: Compression parameters; NULL for the defaults
+ threads: Number of threads; 0 = number of processors. 1 = lzx_compress
+ returns 0 on SUCCESS, otherwise LZX_ERROR */
+int lzx_compress_mt(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params, uint32_t threads);
+
+/* Search the compression parameters for the smallest stream, or the first stream that fits a target size
+ Candidate parameters (block split limits and thresholds, e8 translation, parse level) are derived from
+ params and compressed in batches, one candidate per thread. The search stops after the first batch
+ that produces a stream of at most target_size bytes.
+ src: Input buffer
+ src_size: Input buffer size
+ dest: Address of the output buffer; allocated by the search. must be null
+ compressed_size: Returns the compressed size
+ params: Base compression parameters; the first candidate. NULL for the defaults
+ target_size: Largest acceptable compressed size; 0 = search every candidate for the smallest stream
+ threads: Number of candidates compressed at once; 0 = number of processors
+ returns 0 on SUCCESS, LZX_ERROR_BUFFER_OVERFLOW if no candidate fits target_size (dest holds the smallest stream), otherwise LZX_ERROR */
+int lzx_compress_fit(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params, uint32_t target_size, uint32_t threads);
+
+/* Compress the input buffer, reusing the frames of a previous compression where the input is unchanged
+ The input is compressed as 128 KB segments, each primed with the window before it, so a segment is only
+ recompressed if its data or the window before it changed. The checkpoint holds a digest and the frames
+ of every segment; keep it between runs in a sidecar file.
+ src: Input buffer
+ src_size: Input buffer size
+ dest: Address of the output buffer; allocated. must be null
  compressed_size: Returns the compressed size
+ params: Compression parameters; NULL for the defaults. a checkpoint made with other parameters is ignored
+ checkpoint: The checkpoint from the previous run; NULL for none
+ checkpoint_size: Checkpoint size
+ new_checkpoint: Address of the new checkpoint; allocated. must be null
+ new_checkpoint_size: Returns the new checkpoint size
+ reused_size: Returns the number of input bytes whose frames were reused; can be NULL
+ threads: Number of segments compressed at once; 0 = number of processors
  returns 0 on SUCCESS, otherwise LZX_ERROR */
-int lzx_compress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size);
+int lzx_compress_incremental(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params,
+    const uint8_t* checkpoint, const uint32_t checkpoint_size, uint8_t** new_checkpoint, uint32_t* new_checkpoint_size, uint32_t* reused_size, uint32_t threads);
 
 #ifdef __cplusplus
 };
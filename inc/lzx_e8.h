@@ -0,0 +1,48 @@
+// lzx_e8.h: e8 call translation for the lzx encoder and decoder
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef LZX_E8_H
+#define LZX_E8_H
+
+// std incl
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// translate the relative operands of e8 calls in a frame to absolute ones before compression.
+// mem: the frame.
+// bytes: the frame size.
+// instr_pos: the position of the frame in the stream.
+// file_size: the translation size.
+// calls in the last 10 bytes of the frame are not translated.
+void lzx_e8_encode(uint8_t* mem, uint32_t bytes, uint32_t instr_pos, uint32_t file_size);
+
+// translate the absolute operands of e8 calls in a frame back to relative ones after decompression.
+// the parameters are the same as lzx_e8_encode.
+void lzx_e8_decode(uint8_t* mem, uint32_t bytes, uint32_t instr_pos, uint32_t file_size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // !LZX_E8_H
@@ -0,0 +1,59 @@
+// lzx_match.h: match length kernels for the lzx match finders
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef LZX_MATCH_H
+#define LZX_MATCH_H
+
+// std incl
+#include <stdint.h>
+
+// count the matching bytes of a and b, starting at len.
+// a, b: the strings to compare.
+// len: the number of bytes already known to match.
+// limit: the maximum length to count.
+// returns the index of the first mismatch, or limit if a and b match up to limit.
+// never reads a[limit] or b[limit].
+typedef int (*LZX_MATCH_LEN_PROC)(const uint8_t* a, const uint8_t* b, int len, int limit);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// byte at a time match length.
+int lzx_match_len_byte(const uint8_t* a, const uint8_t* b, int len, int limit);
+
+// word at a time match length.
+int lzx_match_len_word(const uint8_t* a, const uint8_t* b, int len, int limit);
+
+// get the fastest match length kernel supported by this processor.
+LZX_MATCH_LEN_PROC lzx_get_match_len_proc();
+
+// returns non-zero if the processor and os support avx2.
+int lzx_cpu_has_avx2();
+
+// returns non-zero if the processor supports sse2.
+int lzx_cpu_has_sse2();
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // !LZX_MATCH_H
@@ -26,6 +26,7 @@
 
 extern int memtrack_allocations;
 extern long memtrack_allocatedBytes;
+extern long memtrack_totalAllocations; // allocations made since startup, including reallocs
 
 #ifdef __cplusplus
 extern "C" {
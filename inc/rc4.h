@@ -23,6 +23,9 @@
 #define RC4_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#define RC4_MULTI_LANES 4
 
 typedef struct _RC4_CONTEXT {
     uint8_t k;
@@ -39,6 +42,14 @@ void rc4_key(RC4_CONTEXT* context, const uint8_t* key, const size_t len);
 void rc4(RC4_CONTEXT* context, uint8_t* data, const size_t size);
 void rc4_symmetric_enc_dec(uint8_t* data, const size_t size, const uint8_t* key, const size_t key_len);
 
+// advance the keystream by size bytes without en/decrypting anything.
+void rc4_skip(RC4_CONTEXT* context, const size_t size);
+
+// generate the keystream bytes offset to offset + size for many keys at once.
+// keys: count keys of key_len bytes, back to back.
+// out: receives size bytes of keystream per key, in key order.
+void rc4_multi_keystream(const uint8_t* keys, const size_t key_len, const size_t count, const size_t offset, uint8_t* out, const size_t size);
+
 #ifdef __cplusplus
 };
 #endif
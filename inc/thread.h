@@ -0,0 +1,59 @@
+// thread.h: minimal worker thread helpers
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+#ifndef XB_THREAD_H
+#define XB_THREAD_H
+
+// std incl
+#include <stdint.h>
+
+#define THREAD_MAX_COUNT 64
+
+typedef void (*THREAD_PROC)(void* arg);
+
+typedef struct {
+	void* handle;
+	THREAD_PROC proc;
+	void* arg;
+} THREAD;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// start a thread.
+// thread: the thread to start.
+// proc: the thread function.
+// arg: the argument passed to the thread function.
+// returns 0 if successful, 1 otherwise.
+int thread_start(THREAD* thread, THREAD_PROC proc, void* arg);
+
+// wait for a thread to finish and release it.
+void thread_join(THREAD* thread);
+
+// get the number of logical processors.
+uint32_t thread_get_cpu_count();
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // !XB_THREAD_H
@@ -36,12 +36,31 @@
 #include "rsa.h"
 #include "sha1.h"
 #include "tea.h"
+#include "nt_headers.h"
+#include "thread.h"
 
 #ifdef MEM_TRACKING
 #include "mem_tracking.h"
 #endif
 
+#define KEYRING_BATCH_SIZE 64    // keys per rc4_multi_keystream call
+#define KEYRING_MIN_THREAD_KEYS 64 // fewest keys worth a thread
+#define KEYRING_CHECK_SIZE 16      // boot params bytes checked; every field but the digest
+
+// keyring search job; one per thread.
+typedef struct {
+	const uint8_t* keys;
+	const uint8_t* boot_params;
+	uint32_t key_len;
+	uint32_t count;
+	uint32_t offset;
+	uint32_t size;
+	int found;
+} KEYRING_JOB;
+
 static int validate_required_space(const uint32_t requiredSpace, uint32_t* size);
+static int compress_kernel_image(BIOS_BUILD_PARAMS* build_params, const uint32_t romsize);
+static void preldr_create_key(const uint8_t* nonce, const uint8_t* sbkey, uint8_t* key);
 
 int Bios::load(uint8_t* buff, const uint32_t binsize, const BIOS_LOAD_PARAMS* bios_params) {
 	// load bios
@@ -98,6 +117,14 @@ int Bios::load(uint8_t* buff, const uint32_t binsize, const BIOS_LOAD_PARAMS* bi
 int Bios::build(BIOS_BUILD_PARAMS* build_params, uint32_t binsize, BIOS_LOAD_PARAMS* bios_params) {
 	// build a bios from the build parameters
 
+	// compress the kernel image if a decompressed image was provided.
+	if (build_params->kernel_size >= sizeof(uint16_t) && *(uint16_t*)build_params->compressed_kernel == IMAGE_DOS_SIGNATURE) {
+		if (compress_kernel_image(build_params, bios_params->romsize) != 0) {
+			bios_status = BIOS_LOAD_STATUS_FAILED;
+			return bios_status;
+		}
+	}
+
 	const uint32_t requiredSpace = BLDR_BLOCK_SIZE + MCPX_BLOCK_SIZE + build_params->kernel_size + build_params->kernel_data_size + build_params->init_tbl_size;
 
 	if (build_params->bfm) {
@@ -163,8 +190,6 @@ int Bios::build(BIOS_BUILD_PARAMS* build_params, uint32_t binsize, BIOS_LOAD_PAR
 		memcpy(bldr.keys->cert_key, build_params->cert_key, XB_KEY_SIZE);
 	}
 
-	// to-do add option to compress a kernel image.
-
 	// copy in the compressed kernel image.
 	memcpy(kernel.compressed_kernel_ptr, build_params->compressed_kernel, build_params->kernel_size);
 
@@ -337,7 +362,9 @@ int Bios::validateBldrBootParams() {
 void Bios::preldrCreateKey(uint8_t* sbkey, uint8_t* key) {
 	// create the bldr key from the sb key.
 
-	uint8_t* nonce = (preldr.data + PRELDR_BLOCK_SIZE - PRELDR_NONCE_SIZE);
+	preldr_create_key(preldr.data + PRELDR_BLOCK_SIZE - PRELDR_NONCE_SIZE, sbkey, key);
+}
+static void preldr_create_key(const uint8_t* nonce, const uint8_t* sbkey, uint8_t* key) {
 	SHA1Context sha = { 0 };
 	SHA1Reset(&sha);
 	SHA1Input(&sha, sbkey, XB_KEY_SIZE);
@@ -505,9 +532,9 @@ void Bios::preldrSymmetricEncDecBldr(const uint8_t* key, const uint32_t len) {
 	// decrypt 2BL up to FBL
 	rc4(&context, bldr.data, BLDR_BLOCK_SIZE - PRELDR_BLOCK_SIZE);
 
-	// seed context; we do this so we dont mangle the FBL decrypting 2BL
+	// skip the keystream over the FBL; we do this so we dont mangle the FBL decrypting 2BL
 	// but still correctly decrypt parts after the preldr block.
-	rc4(&context, NULL, PRELDR_BLOCK_SIZE - PRELDR_PARAMS_SIZE);
+	rc4_skip(&context, PRELDR_BLOCK_SIZE - PRELDR_PARAMS_SIZE);
 
 	// decrypt parts after the preldr block; FBL params, 2BL boot params.
 	rc4(&context, bldr.data + BLDR_BLOCK_SIZE - PRELDR_PARAMS_SIZE, PRELDR_PARAMS_SIZE);
@@ -576,15 +603,30 @@ int Bios::decompressKrnl() {
 		return 1;
 	}
 
-	// use decompression function.
-	uint32_t buffer_size = (1 * 1024 * 1024 / 2); // 512 kb ( 26 blocks )
+	// size the image from the frame headers so it is allocated once.
+	uint32_t img_size = 0;
+	if (lzx_get_decompressed_size(kernel.compressed_kernel_ptr, bldr.boot_params->compressed_kernel_size, &img_size) != 0)
+		return 1;
+
+	uint32_t buffer_size = lzx_decompress_bound(img_size);
 	kernel.img = (uint8_t*)malloc(buffer_size);
 	if (kernel.img == NULL)
 		return 1;
-	if (lzx_decompress(kernel.compressed_kernel_ptr, bldr.boot_params->compressed_kernel_size, &kernel.img, &buffer_size, &kernel.img_size) != 0)
+	if (lzx_decompress_mt(kernel.compressed_kernel_ptr, bldr.boot_params->compressed_kernel_size, &kernel.img, &buffer_size, &kernel.img_size, 0) != 0)
 		return 1;		
 	return 0;
 }
+int Bios::decompressKrnlRange(uint32_t offset, uint32_t size, uint8_t* dest) {
+	// decompress part of the kernel
+
+	if (kernel.compressed_kernel_ptr == NULL || bios_status != BIOS_LOAD_STATUS_SUCCESS) {
+		return 1;
+	}
+
+	if (lzx_decompress_range(kernel.compressed_kernel_ptr, bldr.boot_params->compressed_kernel_size, offset, size, dest) != 0)
+		return 1;
+	return 0;
+}
 int Bios::preldrDecryptPublicKey() {
 	// decrypt the preldr public key
 
@@ -733,6 +775,11 @@ void bios_init_build_params(BIOS_BUILD_PARAMS* params) {
 	params->init_tbl_size = 0;
 	params->kernel_size = 0;
 	params->kernel_data_size = 0;
+	params->threads = 1;
+	params->checkpoint = NULL;
+	params->checkpoint_size = 0;
+	params->incremental = false;
+	lzx_init_compression_params(&params->lzx_params);
 	params->bfm = false;
 	params->hackinittbl = false;
 	params->hacksignature = false;
@@ -767,6 +814,10 @@ void bios_free_build_params(BIOS_BUILD_PARAMS* params) {
 		free(params->cert_key);
 		params->cert_key = NULL;
 	}
+	if (params->checkpoint != NULL) {
+		free(params->checkpoint);
+		params->checkpoint = NULL;
+	}
 }
 
 static int validate_required_space(const uint32_t requiredSpace, uint32_t* size) {
@@ -784,3 +835,182 @@ static int validate_required_space(const uint32_t requiredSpace, uint32_t* size)
 
 	return 0;
 }
+static int compress_kernel_image(BIOS_BUILD_PARAMS* build_params, const uint32_t romsize) {
+	// compress the kernel image; replaces the image with the compressed kernel.
+	// the encoder parameters are searched for the first stream that fits the space the rest
+	// of the bios leaves in the rom, or the smallest stream if none does.
+	// an incremental build reuses the frames of unchanged chunks from the checkpoint instead.
+
+	uint8_t* compressed_kernel = NULL;
+	uint8_t* checkpoint = NULL;
+	uint32_t checkpoint_size = 0;
+	uint32_t compressed_size = 0;
+	uint32_t reused_size = 0;
+	uint32_t budget = 0;
+	uint32_t otherSpace = BLDR_BLOCK_SIZE + MCPX_BLOCK_SIZE + build_params->kernel_data_size + build_params->init_tbl_size;
+	int result;
+
+	if (romsize > otherSpace) {
+		budget = romsize - otherSpace;
+	}
+
+	printf("Compressing kernel\n");
+	if (build_params->incremental) {
+		result = lzx_compress_incremental(build_params->compressed_kernel, build_params->kernel_size, &compressed_kernel, &compressed_size, &build_params->lzx_params,
+			build_params->checkpoint, build_params->checkpoint_size, &checkpoint, &checkpoint_size, &reused_size, build_params->threads);
+		if (result == 0) {
+			printf("Reused %u of %u bytes from the checkpoint\n", reused_size, build_params->kernel_size);
+			if (build_params->checkpoint != NULL) {
+				free(build_params->checkpoint);
+			}
+			build_params->checkpoint = checkpoint;
+			build_params->checkpoint_size = checkpoint_size;
+		}
+	}
+	else {
+		result = lzx_compress_fit(build_params->compressed_kernel, build_params->kernel_size, &compressed_kernel, &compressed_size, &build_params->lzx_params, budget, build_params->threads);
+	}
+	if (result == LZX_ERROR_BUFFER_OVERFLOW && compressed_kernel != NULL) {
+		printf("Kernel does not fit in %u bytes; using the smallest stream\n", budget);
+		result = 0;
+	}
+	if (result != 0) {
+		printf("Error: Failed to compress kernel\n");
+		if (compressed_kernel != NULL) {
+			free(compressed_kernel);
+		}
+		return result;
+	}
+
+	printf("Compressed kernel %u -> %u bytes\n", build_params->kernel_size, compressed_size);
+
+	free(build_params->compressed_kernel);
+	build_params->compressed_kernel = compressed_kernel;
+	build_params->kernel_size = compressed_size;
+
+	return 0;
+}
+
+static void search_keyring(void* arg) {
+	// decrypt the boot params with each key until one looks valid.
+
+	KEYRING_JOB* job = (KEYRING_JOB*)arg;
+	uint8_t keystream[KEYRING_BATCH_SIZE * KEYRING_CHECK_SIZE];
+	BOOT_PARAMS boot_params = { 0 };
+
+	job->found = -1;
+
+	for (uint32_t i = 0; i < job->count; i += KEYRING_BATCH_SIZE) {
+		uint32_t batch = job->count - i;
+		if (batch > KEYRING_BATCH_SIZE)
+			batch = KEYRING_BATCH_SIZE;
+
+		rc4_multi_keystream(job->keys + i * job->key_len, job->key_len, batch, job->offset, keystream, KEYRING_CHECK_SIZE);
+
+		for (uint32_t k = 0; k < batch; ++k) {
+			for (uint32_t b = 0; b < KEYRING_CHECK_SIZE; ++b) {
+				((uint8_t*)&boot_params)[b] = job->boot_params[b] ^ keystream[k * KEYRING_CHECK_SIZE + b];
+			}
+
+			if (boot_params.signature == BOOT_SIGNATURE &&
+				boot_params.compressed_kernel_size <= job->size &&
+				boot_params.uncompressed_kernel_data_size <= job->size &&
+				boot_params.init_tbl_size <= job->size) {
+				job->found = i + k;
+				return;
+			}
+		}
+	}
+}
+
+int bios_find_bldr_key(const uint8_t* data, const uint32_t size, const uint8_t* keys, const uint32_t key_count, uint32_t threads) {
+	// find the sb key that decrypts the 2BL; only the boot params are decrypted for each key.
+
+	const uint8_t* bldr_data = NULL;
+	const uint8_t* preldr_data = NULL;
+	const uint8_t* rc4_keys = keys;
+	uint8_t* preldr_keys = NULL;
+	KEYRING_JOB jobs[THREAD_MAX_COUNT];
+	THREAD thread_handles[THREAD_MAX_COUNT];
+	uint32_t key_len = XB_KEY_SIZE;
+	uint32_t offset = BLDR_BLOCK_SIZE - sizeof(BOOT_PARAMS);
+	uint32_t keys_per_job = 0;
+	uint32_t job_count = 0;
+	int found = -1;
+
+	if (data == NULL || keys == NULL || key_count == 0 || size < BLDR_BLOCK_SIZE + MCPX_BLOCK_SIZE)
+		return -1;
+
+	bldr_data = data + size - BLDR_BLOCK_SIZE - MCPX_BLOCK_SIZE;
+	preldr_data = bldr_data + BLDR_BLOCK_SIZE - PRELDR_BLOCK_SIZE;
+
+	// a FBL bios decrypts the 2BL with a key made from the sb key and the FBL nonce,
+	// and the boot params sit in front of the nonce.
+	if (((const PRELDR_PARAMS*)preldr_data)->jmp_opcode == 0xE9) {
+		preldr_keys = (uint8_t*)malloc(key_count * SHA1_DIGEST_LEN);
+		if (preldr_keys == NULL)
+			return -1;
+
+		for (uint32_t i = 0; i < key_count; ++i) {
+			preldr_create_key(preldr_data + PRELDR_BLOCK_SIZE - PRELDR_NONCE_SIZE, keys + i * XB_KEY_SIZE, preldr_keys + i * SHA1_DIGEST_LEN);
+		}
+
+		rc4_keys = preldr_keys;
+		key_len = SHA1_DIGEST_LEN;
+		offset -= PRELDR_NONCE_SIZE;
+	}
+
+	if (threads == 0) {
+		threads = thread_get_cpu_count();
+	}
+	if (threads > THREAD_MAX_COUNT) {
+		threads = THREAD_MAX_COUNT;
+	}
+
+	// whole lanes per job, so only the last job runs keys one at a time.
+	keys_per_job = (key_count + threads - 1) / threads;
+	if (keys_per_job < KEYRING_MIN_THREAD_KEYS) {
+		keys_per_job = KEYRING_MIN_THREAD_KEYS;
+	}
+	keys_per_job = (keys_per_job + RC4_MULTI_LANES - 1) & ~(RC4_MULTI_LANES - 1);
+	job_count = (key_count + keys_per_job - 1) / keys_per_job;
+
+	for (uint32_t i = 0; i < job_count; ++i) {
+		uint32_t first = i * keys_per_job;
+		jobs[i].keys = rc4_keys + first * key_len;
+		jobs[i].boot_params = bldr_data + offset;
+		jobs[i].key_len = key_len;
+		jobs[i].count = (key_count - first < keys_per_job) ? key_count - first : keys_per_job;
+		jobs[i].offset = offset;
+		jobs[i].size = size;
+		jobs[i].found = -1;
+	}
+
+	if (job_count == 1) {
+		search_keyring(&jobs[0]);
+	}
+	else {
+		for (uint32_t i = 0; i < job_count; ++i) {
+			if (thread_start(&thread_handles[i], search_keyring, &jobs[i]) != 0) {
+				// search on this thread instead.
+				search_keyring(&jobs[i]);
+			}
+		}
+		for (uint32_t i = 0; i < job_count; ++i) {
+			thread_join(&thread_handles[i]);
+		}
+	}
+
+	for (uint32_t i = 0; i < job_count; ++i) {
+		if (jobs[i].found != -1) {
+			found = i * keys_per_job + jobs[i].found;
+			break;
+		}
+	}
+
+	if (preldr_keys != NULL) {
+		free(preldr_keys);
+	}
+
+	return found;
+}
@@ -114,11 +114,20 @@ static const PARAM_TBL param_tbl[] = {
 	{ "dir", &params.working_directory_path, SW_WORKING_DIRECTORY, PARAM_TBL::STR },
 	{ "xcodes", &params.xcodes_file, SW_XCODES, PARAM_TBL::STR },
 	{ "offset", &params.offset, SW_OFFSET, PARAM_TBL::INT },
+	{ "threads", &params.threads, SW_THREADS, PARAM_TBL::INT },
+	{ "mf", &params.match_finder, SW_MATCH_FINDER, PARAM_TBL::STR },
+	{ "level", &params.level, SW_LEVEL, PARAM_TBL::INT },
+	{ "checkpoint", &params.checkpoint_file, SW_CHECKPOINT, PARAM_TBL::STR },
+	{ "keyring", &params.keyring_dir, SW_KEYRING, PARAM_TBL::STR },
 };
 
 uint8_t* load_init_tbl_file(uint32_t* size, uint32_t* base);
 void lzx_print_error(int error);
 
+static bool isStdioStream(const char* filename) {
+	return filename != NULL && strcmp(filename, FILE_STDIO_NAME) == 0;
+}
+
 // Command Functions
 
 int buildBios() {
@@ -144,6 +153,17 @@ int buildBios() {
 	build_params.hackinittbl = isFlagSet(SW_HACK_INITTBL);
 	build_params.hacksignature = isFlagSet(SW_HACK_SIGNATURE);
 	build_params.nobootparams = isFlagSet(SW_UPDATE_BOOT_PARAMS);
+	build_params.threads = params.threads;
+	build_params.lzx_params = params.lzx_params;
+
+	// kernel compression checkpoint; the first build creates it.
+	if (isFlagSet(SW_CHECKPOINT)) {
+		build_params.incremental = true;
+		if (fileExists(params.checkpoint_file)) {
+			printf("Checkpoint file:\t%s\n", params.checkpoint_file);
+			build_params.checkpoint = readFile(params.checkpoint_file, &build_params.checkpoint_size, 0);
+		}
+	}
 
 	if (params.mcpx_file != NULL)
 		printf("mcpx file:\t\t%s\n", params.mcpx_file);
@@ -173,7 +193,7 @@ int buildBios() {
 		goto Cleanup;
 	}
 
-	// compressed krnl image
+	// krnl image; compressed or decompressed
 	printf("Kernel file:\t\t%s\n", params.kernel_file);
 	build_params.compressed_kernel = readFile(params.kernel_file, &build_params.kernel_size, 0);
 	if (build_params.compressed_kernel == NULL) {
@@ -227,6 +247,10 @@ int buildBios() {
 		if (filename == NULL)
 			filename = "bios.bin";
 		result = writeFileF(filename, "bios", bios.data, bios.size);
+
+		if (result == 0 && build_params.incremental && build_params.checkpoint != NULL) {
+			result = writeFileF(params.checkpoint_file, "checkpoint", build_params.checkpoint, build_params.checkpoint_size);
+		}
 	}
 
 Cleanup:
@@ -271,6 +295,12 @@ int extractBios() {
 		printf("mcpx file: %s\n", params.mcpx_file);
 	printf("bios file: %s\nbios size: %d kb\nrom size:  %d kb\n\n", params.in_file, size / 1024, params.romsize / 1024);
 
+	if (find_keyring_key(buffer, size) != 0) {
+		free(buffer);
+		return 1;
+	}
+	bios_params.bldr_key = params.bldr_key;
+
 	result = bios.load(buffer, size, &bios_params);
 	if (result != BIOS_LOAD_STATUS_SUCCESS) {
 		printf("Error: invalid 2BL\n");		
@@ -635,6 +665,12 @@ int listBios() {
 	if (params.mcpx_file != NULL) printf("mcpx file: %s\n", params.mcpx_file);
 	printf("bios file: %s\nbios size: %d kb\nrom size:  %d kb\n\n", params.in_file, size / 1024, params.romsize / 1024);
 
+	if (find_keyring_key(buffer, size) != 0) {
+		free(buffer);
+		return 1;
+	}
+	bios_params.bldr_key = params.bldr_key;
+
 	biosStatus = bios.load(buffer, size, &bios_params);	
 	if (biosStatus > BIOS_LOAD_STATUS_INVALID_BLDR) {
 		printf("Error: Failed to load BIOS\n");
@@ -670,14 +706,26 @@ int listBios() {
 			return 1;
 		}
 
-		// decompress the kernel so the NT header can be dumped.
-		bios.decompressKrnl();
+		// the NT header is at the start of the image; decompress the first frame only.
+		uint32_t img_size = 0;
+		uint32_t hdr_size = 0;
+		uint8_t* hdr = NULL;
+		if (lzx_get_decompressed_size(bios.kernel.compressed_kernel_ptr, bios.bldr.boot_params->compressed_kernel_size, &img_size) == 0) {
+			hdr_size = (img_size < LZX_CHUNK_SIZE) ? img_size : LZX_CHUNK_SIZE;
+			hdr = (uint8_t*)malloc(hdr_size);
+			if (hdr != NULL && bios.decompressKrnlRange(0, hdr_size, hdr) != 0) {
+				free(hdr);
+				hdr = NULL;
+			}
+		}
 
 		printf("Kernel:\n");
-		if (bios.kernel.img != NULL) {
-			printf("Image size: %d bytes\n", bios.kernel.img_size);
-			dump_nt_headers(bios.kernel.img, bios.kernel.img_size, false);
-			print_krnl_data_section_header((IMAGE_DOS_HEADER*)bios.kernel.img);
+		if (hdr != NULL) {
+			printf("Image size: %d bytes\n", img_size);
+			dump_nt_headers(hdr, hdr_size, false);
+			print_krnl_data_section_header((IMAGE_DOS_HEADER*)hdr);
+			free(hdr);
+			hdr = NULL;
 		}
 		else {
 			printf("Error: Failed to decompress kernel image\n");
@@ -1024,6 +1072,10 @@ int compressFile() {
 
 	printf("Compress File\n\n");
 
+	if (isStdioStream(params.in_file) || isStdioStream(params.out_file)) {
+		return compressStream();
+	}
+
 	data = readFile(params.in_file, &dataSize, 0);
 	if (data == NULL) {
 		return 1;
@@ -1032,7 +1084,7 @@ int compressFile() {
 	printf("file: %s\n\n", params.in_file);
 
 	printf("Compressing file\n");
-	result = lzx_compress(data, dataSize, &buff, &compressedSize);
+	result = lzx_compress_mt(data, dataSize, &buff, NULL, &compressedSize, &params.lzx_params, params.threads);
 	if (result != 0) {
 		printf("Error: Compression failed, ");
 		lzx_print_error(result);
@@ -1073,6 +1125,10 @@ int decompressFile() {
 
 	printf("Decompress File\n\n");
 
+	if (isStdioStream(params.in_file) || isStdioStream(params.out_file)) {
+		return decompressStream();
+	}
+
 	data = readFile(params.in_file, &dataSize, 0);
 	if (data == NULL) {
 		return 1;
@@ -1081,7 +1137,8 @@ int decompressFile() {
 	printf("file: %s\n\n", params.in_file);
 
 	printf("Decompressing file\n");
-	result = lzx_decompress(data, dataSize, &buff, NULL, &decompressedSize);
+	// the thread count defaults to 1 for compression; decompression picks its own.
+	result = lzx_decompress_mt(data, dataSize, &buff, NULL, &decompressedSize, isFlagSet(SW_THREADS) ? params.threads : 0);
 	if (result != 0) {
 		printf("Error: Decompression failed, ");
 		lzx_print_error(result);
@@ -1107,6 +1164,93 @@ Cleanup:
 
 	return result;
 }
+int compressStream() {
+	// lzx compress between file descriptors in chunks
+
+	int in_fd = -1;
+	int out_fd = -1;
+	uint32_t dataSize = 0;
+	uint32_t compressedSize = 0;
+	int result = 0;
+	float savings = 0;
+
+	in_fd = openFileFd(params.in_file, false);
+	if (in_fd == -1) {
+		return 1;
+	}
+
+	out_fd = openFileFd(params.out_file, true);
+	if (out_fd == -1) {
+		result = 1;
+		goto Cleanup;
+	}
+
+	printf("file: %s\n\n", params.in_file);
+
+	printf("Compressing stream\n");
+	result = lzx_compress_fd(in_fd, out_fd, &params.lzx_params, &dataSize, &compressedSize);
+	if (result != 0) {
+		printf("Error: Compression failed, ");
+		lzx_print_error(result);
+		goto Cleanup;
+	}
+
+	if (dataSize > 0) {
+		savings = (1 - ((float)compressedSize / (float)dataSize)) * 100;
+	}
+	printf("Compressed %u -> %u bytes (%.3f%% compression)\n", dataSize, compressedSize, savings);
+
+Cleanup:
+
+	closeFileFd(in_fd);
+	closeFileFd(out_fd);
+
+	return result;
+}
+int decompressStream() {
+	// lzx decompress between file descriptors frame by frame
+
+	int in_fd = -1;
+	int out_fd = -1;
+	uint32_t dataSize = 0;
+	uint32_t decompressedSize = 0;
+	int result = 0;
+	float savings = 0;
+
+	in_fd = openFileFd(params.in_file, false);
+	if (in_fd == -1) {
+		return 1;
+	}
+
+	out_fd = openFileFd(params.out_file, true);
+	if (out_fd == -1) {
+		result = 1;
+		goto Cleanup;
+	}
+
+	printf("file: %s\n\n", params.in_file);
+
+	printf("Decompressing stream\n");
+	result = lzx_decompress_fd(in_fd, out_fd, &dataSize, &decompressedSize);
+	if (result != 0) {
+		printf("Error: Decompression failed, ");
+		lzx_print_error(result);
+		goto Cleanup;
+	}
+
+	if (decompressedSize > 0) {
+		savings = (1 - ((float)dataSize / (float)decompressedSize)) * 100;
+	}
+	printf("Decompressed %u -> %u bytes (%.3f%% compression)\n", dataSize, decompressedSize, savings);
+
+Cleanup:
+
+	closeFileFd(in_fd);
+	closeFileFd(out_fd);
+
+	return result;
+}
+
 int dumpCoffPeImg() {
 	int result = 0;
 	uint8_t* data = NULL;
@@ -1175,10 +1319,11 @@ int help() {
 				return 0;
 
 			case CMD_BUILD_BIOS:
-				printf("# %s\n\n %s (req)\n %s (req)\n %s (req)\n %s (req)\n %s\n %s\n %s %s\n %s %s\n %s\n %s\n %s\n %s\n\n",
+				printf("# %s\n\n %s (req)\n %s (req)\n %s (req)\n %s (req)\n %s\n %s\n %s %s\n %s %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n\n",
 					HELP_STR_BUILD, HELP_STR_PARAM_BLDR, HELP_STR_PARAM_KRNL, HELP_STR_PARAM_KRNL_DATA, HELP_STR_PARAM_INITTBL, HELP_STR_PARAM_PRELDR,
 					HELP_STR_PARAM_OUT_BIOS_FILE, HELP_STR_PARAM_ROMSIZE, HELP_STR_VALID_ROM_SIZES, HELP_STR_PARAM_BINSIZE, HELP_STR_VALID_ROM_SIZES,
-					HELP_STR_PARAM_BFM, HELP_STR_PARAM_HACK_INITTBL, HELP_STR_PARAM_HACK_SIGNATURE, HELP_STR_PARAM_UPDATE_BOOT_PARAMS);
+					HELP_STR_PARAM_BFM, HELP_STR_PARAM_HACK_INITTBL, HELP_STR_PARAM_HACK_SIGNATURE, HELP_STR_PARAM_UPDATE_BOOT_PARAMS, HELP_STR_PARAM_THREADS, HELP_STR_PARAM_MATCH_FINDER, HELP_STR_PARAM_LEVEL,
+					HELP_STR_PARAM_CHECKPOINT);
 				printf("Usage:\nxbios -bld -bldr <path> -krnl <path> -krnldata <path> -inittbl <path> [switches]\n");
 				return 0;
 
@@ -1248,14 +1393,15 @@ int help() {
 				return 0;
 
 			case CMD_COMPRESS_FILE:
-				printf("# %s\n\n %s (req) *inferred\n %s (req)\n\n",
-					HELP_STR_COMPRESS_FILE, HELP_STR_PARAM_IN_FILE, HELP_STR_PARAM_OUT_FILE);
+				printf("# %s\n\n %s (req) *inferred\n %s (req)\n %s\n %s\n %s\n\n%s\n\n",
+					HELP_STR_COMPRESS_FILE, HELP_STR_PARAM_IN_FILE, HELP_STR_PARAM_OUT_FILE, HELP_STR_PARAM_THREADS, HELP_STR_PARAM_MATCH_FINDER, HELP_STR_PARAM_LEVEL,
+					HELP_STR_STDIO_STREAM);
 				printf("Usage: xbios -compress <path> [switches]\n");
 				return 0;
 
 			case CMD_DECOMPRESS_FILE:
-				printf("# %s\n\n %s (req) *inferred\n %s (req)\n\n",
-					HELP_STR_DECOMPRESS_FILE, HELP_STR_PARAM_IN_FILE, HELP_STR_PARAM_OUT_FILE);
+				printf("# %s\n\n %s (req) *inferred\n %s (req)\n %s\n\n%s\n\n",
+					HELP_STR_DECOMPRESS_FILE, HELP_STR_PARAM_IN_FILE, HELP_STR_PARAM_OUT_FILE, HELP_STR_PARAM_DECOMPRESS_THREADS, HELP_STR_STDIO_STREAM);
 				printf("Usage: xbios -decompress <path> [switches]\n");
 				return 0;
 
@@ -1296,6 +1442,9 @@ int helpEncryption() {
 	printf("\n -key-bldr");
 	printf(HELP_STR_RC4_KEY, "2BL");
 
+	// 2BL keyring
+	printf("\n\n %s", HELP_STR_KEYRING);
+
 	// kernel 
 	printf("\n\nKernel encryption / decryption:\nOnly needed for custom BIOSes as keys are located in the 2BL.\n\n");
 	printf(" -key-krnl");
@@ -1449,6 +1598,114 @@ int read_keys() {
 
 	return 0;
 }
+typedef struct {
+	uint8_t* keys;
+	char** names;
+	uint32_t count;
+	uint32_t capacity;
+} KEYRING;
+
+static void add_keyring_file(const char* path, const char* name, void* arg) {
+	// add a key file to the keyring; files that are not 16 bytes are skipped.
+
+	KEYRING* keyring = (KEYRING*)arg;
+	FILE* file = NULL;
+	uint32_t size = 0;
+
+	fopen_s(&file, path, "rb");
+	if (file == NULL)
+		return;
+
+	getFileSize(file, &size);
+	if (size != XB_KEY_SIZE) {
+		fclose(file);
+		return;
+	}
+
+	if (keyring->count == keyring->capacity) {
+		uint32_t capacity = keyring->capacity ? keyring->capacity * 2 : 64;
+		uint8_t* keys = (uint8_t*)realloc(keyring->keys, capacity * XB_KEY_SIZE);
+		if (keys == NULL) {
+			fclose(file);
+			return;
+		}
+		keyring->keys = keys;
+		char** names = (char**)realloc(keyring->names, capacity * sizeof(char*));
+		if (names == NULL) {
+			fclose(file);
+			return;
+		}
+		keyring->names = names;
+		keyring->capacity = capacity;
+	}
+
+	if (fread(keyring->keys + keyring->count * XB_KEY_SIZE, 1, XB_KEY_SIZE, file) == XB_KEY_SIZE) {
+		size_t len = strlen(name) + 1;
+		keyring->names[keyring->count] = (char*)malloc(len);
+		if (keyring->names[keyring->count] != NULL) {
+			memcpy(keyring->names[keyring->count], name, len);
+			keyring->count++;
+		}
+	}
+
+	fclose(file);
+}
+int find_keyring_key(const uint8_t* data, const uint32_t size) {
+	// find the 2BL key in the keyring directory; sets params.bldr_key.
+	// the keyring is only searched when no other 2BL key was given.
+
+	KEYRING keyring = { 0 };
+	int found = -1;
+	int result = 0;
+
+	if (isFlagClear(SW_KEYRING) || isFlagSet(SW_ENC_BLDR) || params.bldr_key != NULL || params.mcpx.sbkey != NULL)
+		return 0;
+
+	printf("keyring: %s\n", params.keyring_dir);
+
+	if (listDir(params.keyring_dir, add_keyring_file, &keyring) != 0) {
+		result = 1;
+		goto Cleanup;
+	}
+
+	if (keyring.count == 0) {
+		printf("Error: no 16 byte key files in the keyring\n");
+		result = 1;
+		goto Cleanup;
+	}
+
+	// keys are cheap to test; use every processor unless -threads was given.
+	found = bios_find_bldr_key(data, size, keyring.keys, keyring.count, isFlagSet(SW_THREADS) ? params.threads : 0);
+	if (found == -1) {
+		printf("none of the %u keys decrypt the 2BL\n\n", keyring.count);
+		goto Cleanup;
+	}
+
+	params.bldr_key = (uint8_t*)malloc(XB_KEY_SIZE);
+	if (params.bldr_key == NULL) {
+		result = 1;
+		goto Cleanup;
+	}
+	memcpy(params.bldr_key, keyring.keys + found * XB_KEY_SIZE, XB_KEY_SIZE);
+
+	printf("keyring key: %s ( %u keys tested )\n", keyring.names[found], keyring.count);
+	printf("bldr key: ");
+	uprinth(params.bldr_key, XB_KEY_SIZE);
+	printf("\n");
+
+Cleanup:
+	if (keyring.names != NULL) {
+		for (uint32_t i = 0; i < keyring.count; ++i) {
+			free(keyring.names[i]);
+		}
+		free(keyring.names);
+	}
+	if (keyring.keys != NULL) {
+		free(keyring.keys);
+	}
+
+	return result;
+}
 int read_mcpx() {
 	// read and verify mcpx rom file.
 
@@ -1534,6 +1791,9 @@ void lzx_print_error(int error) {
 		case LZX_ERROR_FAILED:
 			printf("fatal error\n");
 			break;
+		case LZX_ERROR_IO:
+			printf("i/o error\n");
+			break;
 		case LZX_ERROR_SUCCESS:
 			printf("success\n");
 			break;
@@ -1867,11 +2127,54 @@ int validateArgs() {
 		}
 	}
 
+	// compression threads
+	if (isFlagClear(SW_THREADS)) {
+		params.threads = 1;
+	}
+
+	// lzx match finder
+	lzx_init_compression_params(&params.lzx_params);
+	if (isFlagSet(SW_MATCH_FINDER)) {
+		if (strcmp(params.match_finder, "bt") == 0) {
+			params.lzx_params.match_finder = LZX_MATCH_FINDER_BINARY_TREE;
+		}
+		else if (strcmp(params.match_finder, "hc") == 0) {
+			params.lzx_params.match_finder = LZX_MATCH_FINDER_HASH_CHAIN;
+		}
+		else if (strcmp(params.match_finder, "ht") == 0) {
+			params.lzx_params.match_finder = LZX_MATCH_FINDER_HASH_TABLE;
+		}
+		else {
+			printf("Error: invalid match finder: %s\n", params.match_finder);
+			return 1;
+		}
+	}
+
+	// lzx compression level
+	if (isFlagSet(SW_LEVEL)) {
+		if (params.level < LZX_LEVEL_GREEDY || params.level > LZX_LEVEL_ULTRA) {
+			printf("Error: invalid compression level: %u\n", params.level);
+			return 1;
+		}
+		params.lzx_params.level = params.level;
+	}
+
 	return 0;
 }
 
 int main(int argc, char** argv) {
 
+	// data is streamed to stdout; move console output to stderr so it doesn't mix with the data.
+	for (int i = 1; i < argc - 1; i++) {
+		if ((argv[i][0] == '-' || argv[i][0] == '/') && strcmp(argv[i] + 1, "out") == 0 && isStdioStream(argv[i + 1])) {
+			if (redirectStdout() != 0) {
+				printf("Error: could not redirect stdout\n");
+				return ERROR_FAILED;
+			}
+			break;
+		}
+	}
+
 	printf("Xbox Bios Tools by tommojphillips\n\n");
 
 	int result = 0;
@@ -31,6 +31,12 @@ static int cli_flags[CLI_SWITCH_SIZE] = { 0 };
 
 void setParamValue(const PARAM_TBL* param, char* arg);
 
+// a lone '-' is a value (stdin / stdout), not a switch.
+static bool isSwitch(const char* arg)
+{
+	return (arg[0] == '-' || arg[0] == '/') && arg[1] != '\0';
+}
+
 int getCmd(const CMD_TBL* cmds, const int cmd_size, const char* arg, const CMD_TBL** cmd)
 {
 	for (int i = 0; i < (int)(cmd_size / sizeof(CMD_TBL)); i++)
@@ -80,7 +86,7 @@ int parseCli(int argc, char* argv[], const CMD_TBL*& cmd, const CMD_TBL* cmds, c
 	{
 
 		// check for inferred switches
-		if (argv[i][0] != '-' && argv[i][0] != '/')
+		if (!isSwitch(argv[i]))
 		{
 			for (j = 0; j < sizeof(cmd->inferredSwitches) / sizeof(CLI_SWITCH); j++)
 			{
@@ -139,7 +145,7 @@ int parseCli(int argc, char* argv[], const CMD_TBL*& cmd, const CMD_TBL* cmds, c
 					return CLI_ERROR_MISSING_ARG;
 				}
 
-				if (swNeedValue && (argv[i + 1][0] == '-' || argv[i + 1][0] == '/'))
+				if (swNeedValue && isSwitch(argv[i + 1]))
 				{
 					printf("Error: '-%s' switch has an invaild argument, '%s'\n\nUsage: -%s <value>\n", arg, argv[i + 1], arg);
 					return CLI_ERROR_INVALID_ARG;
@@ -21,7 +21,31 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <malloc.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#define open _open
+#define close _close
+#define read _read
+#define write _write
+#define dup _dup
+#define dup2 _dup2
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <errno.h>
+#define O_BINARY 0
+static inline int fopen_s(FILE** file, const char* filename, const char* mode) {
+	*file = fopen(filename, mode);
+	return *file == NULL ? errno : 0;
+}
+#endif
 
 #include "file.h"
 
@@ -142,3 +166,139 @@ int deleteFile(const char* filename) {
 
 	return 0;
 }
+
+// the fd that stdout data is written to; moved by redirectStdout().
+static int stdout_fd = 1;
+
+static bool isStdioName(const char* filename) {
+	return filename != NULL && strcmp(filename, FILE_STDIO_NAME) == 0;
+}
+
+int redirectStdout() {
+	int fd;
+
+	fflush(stdout);
+
+	fd = dup(1);
+	if (fd == -1)
+		return 1;
+
+	if (dup2(2, 1) == -1) {
+		close(fd);
+		return 1;
+	}
+
+	stdout_fd = fd;
+	return 0;
+}
+
+int openFileFd(const char* filename, bool writeAccess) {
+	int fd;
+
+	if (filename == NULL)
+		return -1;
+
+	if (isStdioName(filename)) {
+		fd = writeAccess ? stdout_fd : 0;
+#ifdef _WIN32
+		_setmode(fd, _O_BINARY);
+#endif
+		return fd;
+	}
+
+	if (writeAccess)
+		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	else
+		fd = open(filename, O_RDONLY | O_BINARY);
+
+	if (fd == -1) {
+		printf("Error: could not open file: %s\n", filename);
+	}
+
+	return fd;
+}
+
+void closeFileFd(int fd) {
+	if (fd > 2 && fd != stdout_fd) {
+		close(fd);
+	}
+}
+
+int readFd(int fd, void* ptr, const uint32_t bytesToRead) {
+	uint32_t total = 0;
+	int bytesRead;
+
+	while (total < bytesToRead) {
+		bytesRead = read(fd, (uint8_t*)ptr + total, bytesToRead - total);
+		if (bytesRead < 0)
+			return -1;
+		if (bytesRead == 0)
+			break;
+		total += bytesRead;
+	}
+
+	return (int)total;
+}
+
+int writeFd(int fd, const void* ptr, const uint32_t bytesToWrite) {
+	uint32_t total = 0;
+	int bytesWritten;
+
+	while (total < bytesToWrite) {
+		bytesWritten = write(fd, (const uint8_t*)ptr + total, bytesToWrite - total);
+		if (bytesWritten <= 0)
+			return 1;
+		total += bytesWritten;
+	}
+
+	return 0;
+}
+
+int listDir(const char* dirname, LIST_DIR_PROC proc, void* arg) {
+	char path[1024];
+
+	if (dirname == NULL || proc == NULL)
+		return 1;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA find_data;
+	HANDLE find;
+
+	snprintf(path, sizeof(path), "%s\\*", dirname);
+	find = FindFirstFileA(path, &find_data);
+	if (find == INVALID_HANDLE_VALUE) {
+		printf("Error: could not open directory: %s\n", dirname);
+		return 1;
+	}
+
+	do {
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		snprintf(path, sizeof(path), "%s\\%s", dirname, find_data.cFileName);
+		proc(path, find_data.cFileName, arg);
+	} while (FindNextFileA(find, &find_data));
+
+	FindClose(find);
+#else
+	struct dirent* entry;
+	struct stat st;
+	DIR* dir;
+
+	dir = opendir(dirname);
+	if (dir == NULL) {
+		printf("Error: could not open directory: %s\n", dirname);
+		return 1;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		proc(path, entry->d_name, arg);
+	}
+
+	closedir(dir);
+#endif
+
+	return 0;
+}
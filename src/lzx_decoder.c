@@ -7,7 +7,10 @@
 
 // user incl
 #include "lzx.h"
+#include "lzx_e8.h"
 #include "nt_headers.h"
+#include "file.h"
+#include "thread.h"
 
 #ifdef MEM_TRACKING
 #include "mem_tracking.h"
@@ -28,84 +31,156 @@
 
 #define NUM_DECODE_SMALL 20
 #define DS_TABLE_BITS 8
+#define DS_TABLE_SIZE ((1 << DS_TABLE_BITS) + NUM_DECODE_SMALL * 256 / 9)
 #define E8_CFDATA_FRAME_THRESHOLD 32768
+#define MT_FRAMES_PER_BATCH 4
+#define MT_MIN_FRAMES (2 * MT_FRAMES_PER_BATCH)
+#define MATCH_COPY_SIZE 8
+#define WINDOW_SLACK (LZX_MAX_MATCH + MATCH_COPY_SIZE)
+#define SAFE_INPUT_BYTES 24
+
+// the bit buffer holds up to 63 bits of the stream, first bit at the top. bitcount is the number
+// of bits read from the input; the bits below it are zero or the stream bits that follow. while
+// 8 bytes of input remain, a refill is one load that tops it up to 48..63 bits without branching
+// on the count; near the end of the frame it reads a word at a time. bitcount goes negative once
+// the bits run out.
+#define REFILL_BITBUF(bitbuf, bitcount, curpos, end) \
+    if ((end) - (curpos) >= 8) { \
+        (bitbuf) |= load_bitbuf_words(curpos) >> (bitcount); \
+        (curpos) += ((63 - (bitcount)) >> 4) << 1; \
+        (bitcount) |= 48; \
+    } \
+    else { \
+        while ((bitcount) <= 47 && (end) - (curpos) >= 2) { \
+            (bitbuf) |= (uint64_t)((uint32_t)(curpos)[0] | ((uint32_t)(curpos)[1] << 8)) << (48 - (bitcount)); \
+            (curpos) += 2; \
+            (bitcount) += 16; \
+        } \
+    }
+
+#define FILL_BUF() REFILL_BITBUF(dec_bitbuf, dec_bitcount, dec_input_curpos, dec_end_input_pos)
+
+// the fast loops decode a stretch of output between checks. a symbol takes at most 26 bits of
+// input per byte it outputs and the bit buffer reads at most 8 bytes ahead, so no symbol of a
+// stretch starts more than 8 bytes past the safe input position; the two refills of a symbol then
+// never load past the input and the bit buffer never runs dry.
+#define STRETCH_END(curpos, safe_pos, pos, pos_end) \
+    min((pos_end), (pos) + 1 + (long)(((safe_pos) - (curpos)) >> 2))
+
+#define FILL_BUF_FAST() { \
+    dec_bitbuf |= load_bitbuf_words(dec_input_curpos) >> dec_bitcount; \
+    dec_input_curpos += ((63 - dec_bitcount) >> 4) << 1; \
+    dec_bitcount |= 48; \
+}
 
-#define FILL_BUF_NOEOFCHECK(N) { \
-	dec_bitbuf <<= (N); \
-	dec_bitcount -= (N); \
-	if (dec_bitcount <= 0) { \
-        dec_bitbuf |= ((((uint32_t) *dec_input_curpos | (((uint32_t) *(dec_input_curpos+1)) << 8))) << (-dec_bitcount)); \
-        dec_input_curpos += 2; \
-		dec_bitcount += 16; \
-	} \
+// set the last input position a stretch may start at. once fewer than SAFE_INPUT_BYTES are left,
+// the rest of the input is decoded from the tail; a stretch there outlasts the input bits and
+// only stops in the padding.
+#define NEXT_INPUT_STRETCH() { \
+    if (dec_end_input_pos - dec_input_curpos >= SAFE_INPUT_BYTES) { \
+        dec_safe_input_pos = dec_end_input_pos - SAFE_INPUT_BYTES; \
+    } \
+    else { \
+        dec_input_curpos = begin_input_tail(&tail, dec_input_curpos, dec_end_input_pos); \
+        dec_safe_input_pos = tail.data + sizeof(tail.data) - SAFE_INPUT_BYTES; \
+    } \
 }
-#define FILL_BUF17_NOEOFCHECK(N) { \
-	dec_bitbuf <<= (N); \
-	dec_bitcount -= (N); \
-	if (dec_bitcount <= 0) { \
-        dec_bitbuf |= ((((uint32_t) *dec_input_curpos | (((uint32_t) *(dec_input_curpos+1)) << 8))) << (-dec_bitcount)); \
-        dec_input_curpos += 2; \
-		dec_bitcount += 16; \
-		if (dec_bitcount <= 0) { \
-            dec_bitbuf |= ((((uint32_t) *dec_input_curpos | (((uint32_t) *(dec_input_curpos+1)) << 8))) << (-dec_bitcount)); \
-            dec_input_curpos += 2; \
-			dec_bitcount += 16; \
-		} \
-	} \
+
+// move back from the tail to the input. padding taken into the bit buffer is not input, so it
+// comes off the bit count; a negative count means the padding was decoded.
+#define END_INPUT_STRETCH() { \
+    if (tail.active) { \
+        uint32_t used = (uint32_t)(dec_input_curpos - tail.data); \
+        if (used > tail.input_size) { \
+            dec_bitcount -= (int)(used - tail.input_size) * 8; \
+            used = tail.input_size; \
+        } \
+        dec_input_curpos = tail.input_pos + used; \
+        if (dec_bitcount < 0) \
+            return -1; \
+    } \
 }
 
-#define DECODE_ALIGNED_NOEOFCHECK(j) \
-	(j) = context->aligned_table[dec_bitbuf >> (32 - LZX_ALIGNED_TABLE_BITS)]; \
-	FILL_BUF_NOEOFCHECK(context->aligned_len[(j)]);
+#define DROP_BITS(N) { \
+    dec_bitbuf <<= (N); \
+    dec_bitcount -= (N); \
+}
 
-#define GET_BITS_NOEOFCHECK(N,DEST_VAR) { \
-   DEST_VAR = dec_bitbuf >> (32-(N)); \
-   FILL_BUF_NOEOFCHECK((N)); \
+// a main tree symbol, a length tree symbol and the 15 extra bits of the largest position slot
+// fit in one refill; the aligned offset tree refills again.
+#define DECODE_ALIGNED_NOEOFCHECK(j) { \
+    FILL_BUF(); \
+    (j) = context->aligned_table[dec_bitbuf >> (64 - LZX_ALIGNED_TABLE_BITS)]; \
+    DROP_BITS(context->aligned_len[(j)]); \
 }
 
-#define GET_BITS17_NOEOFCHECK(N,DEST_VAR) { \
-   DEST_VAR = dec_bitbuf >> (32-(N)); \
-   FILL_BUF17_NOEOFCHECK((N)); \
+#define DECODE_ALIGNED_FAST(j) { \
+    FILL_BUF_FAST(); \
+    (j) = context->aligned_table[dec_bitbuf >> (64 - LZX_ALIGNED_TABLE_BITS)]; \
+    DROP_BITS(context->aligned_len[(j)]); \
 }
 
-#define DECODE_MAIN_TREE(j) \
-	j = context->main_tree_table[dec_bitbuf >> (32-MAIN_TREE_TABLE_BITS)]; \
-	if (j < 0) { \
-        uint32_t mask = (1L << (32-1-MAIN_TREE_TABLE_BITS)); \
-		do { \
-	 		j = -j; \
-	 		if (dec_bitbuf & mask) \
-                j = context->main_tree_left_right[j*2+1]; \
-			else \
-                j = context->main_tree_left_right[j*2]; \
-			mask >>= 1; \
-		} while (j < 0); \
-	} \
-    if (dec_input_curpos >= dec_end_input_pos) \
+#define GET_BITS_NOEOFCHECK(N,DEST_VAR) { \
+   DEST_VAR = (uint32_t)(dec_bitbuf >> (64 - (N))); \
+   DROP_BITS((N)); \
+}
+
+// decode table entries. a single entry is a symbol and its code length. a pair entry is a
+// literal followed by a second literal whose codes fit in the first level together. a
+// subtable entry points at the second level table for codes longer than the first level.
+#define TABLE_PAIR (1u << 30)
+#define TABLE_SUBTABLE (2u << 30)
+#define TABLE_KIND(e) ((e) & (3u << 30))
+#define TABLE_SYMBOL(e) ((e) & 0x3FF)
+#define TABLE_LEN(e) (((e) >> 10) & 0x1F)
+#define TABLE_PAIR_LITERAL(e) ((uint8_t)((e) >> 15))
+#define TABLE_PAIR_LEN(e) (((e) >> 23) & 0x1F)
+#define TABLE_SUB_OFFSET(e) ((e) & 0xFFFF)
+#define TABLE_SUB_BITS(e) (((e) >> 16) & 0x1F)
+#define TABLE_ENTRY(sym, len) ((uint32_t)(sym) | ((uint32_t)(len) << 10))
+#define TABLE_PAIR_ENTRY(e, lit, len) ((e) | TABLE_PAIR | ((uint32_t)(lit) << 15) | ((uint32_t)(len) << 23))
+#define TABLE_SUBTABLE_ENTRY(offset, bits) (TABLE_SUBTABLE | (uint32_t)(offset) | ((uint32_t)(bits) << 16))
+
+// look up the code at the top of the bit buffer.
+#define TABLE_LOOKUP(table, tablebits, bitbuf, e) \
+    e = (table)[(bitbuf) >> (64 - (tablebits))]; \
+    if (TABLE_KIND(e) == TABLE_SUBTABLE) \
+        e = (table)[TABLE_SUB_OFFSET(e) + (((bitbuf) << (tablebits)) >> (64 - TABLE_SUB_BITS(e)))];
+
+#define DECODE_MAIN_TREE(j) { \
+    uint32_t e; \
+    FILL_BUF(); \
+    if (dec_bitcount <= 0) \
         return -1; \
-	dec_bitbuf <<= (context->main_tree_len[j]); \
-	dec_bitcount -= (context->main_tree_len[j]); \
-	if (dec_bitcount <= 0) { \
-        dec_bitbuf |= ((((uint32_t) *dec_input_curpos | (((uint32_t) *(dec_input_curpos+1)) << 8))) << (-dec_bitcount)); \
-        dec_input_curpos += 2; \
-		dec_bitcount += 16; \
-    } 
-
-#define DECODE_LEN_TREE_NOEOFCHECK(matchlen) \
-    matchlen = context->secondary_len_tree_table[dec_bitbuf >> (32-SECONDARY_LEN_TREE_TABLE_BITS)]; \
-	if (matchlen < 0) { \
-        uint32_t mask = (1L << (32-1-SECONDARY_LEN_TREE_TABLE_BITS)); \
-		do  { \
-	 		matchlen = -matchlen; \
-	 		if (dec_bitbuf & mask) \
-                matchlen = context->secondary_len_tree_left_right[matchlen*2+1]; \
-			else \
-                matchlen = context->secondary_len_tree_left_right[matchlen*2]; \
-			mask >>= 1; \
-		} while (matchlen < 0);	\
-	} \
-    FILL_BUF_NOEOFCHECK(context->secondary_len_tree_len[matchlen]); \
-	matchlen += LZX_NUM_PRIMARY_LEN;
+    TABLE_LOOKUP(context->main_tree_table, MAIN_TREE_TABLE_BITS, dec_bitbuf, e); \
+    j = TABLE_SYMBOL(e); \
+    DROP_BITS(TABLE_LEN(e)); \
+}
+
+// decode one main tree symbol, or two literals into dest when the first level resolves a
+// pair and both fit before the end of the stretch.
+#define DECODE_MAIN_TREE_PAIR(j, dest) { \
+    uint32_t e; \
+    FILL_BUF_FAST(); \
+    TABLE_LOOKUP(context->main_tree_table, MAIN_TREE_TABLE_BITS, dec_bitbuf, e); \
+    if (TABLE_KIND(e) == TABLE_PAIR && pos + 1 < stretch_end) { \
+        (dest)[0] = (uint8_t)TABLE_SYMBOL(e); \
+        (dest)[1] = TABLE_PAIR_LITERAL(e); \
+        pos += 2; \
+        DROP_BITS(TABLE_PAIR_LEN(e)); \
+        continue; \
+    } \
+    j = TABLE_SYMBOL(e); \
+    DROP_BITS(TABLE_LEN(e)); \
+}
+
+#define DECODE_LEN_TREE_NOEOFCHECK(matchlen) { \
+    uint32_t e; \
+    TABLE_LOOKUP(context->secondary_len_tree_table, SECONDARY_LEN_TREE_TABLE_BITS, dec_bitbuf, e); \
+    matchlen = TABLE_SYMBOL(e); \
+    DROP_BITS(TABLE_LEN(e)); \
+    matchlen += LZX_NUM_PRIMARY_LEN; \
+}
 
 static const uint8_t lzx_extra_bits[] = {
     0,0,0,0,1,1,2,2,
@@ -127,210 +202,213 @@ static const long match_pos_minus2[sizeof(lzx_extra_bits)] = {
     1835008 - 2,  1966080 - 2,  2097152 - 2
 };
 
-static void init_bitbuf(LZX_DECODER_CONTEXT* context) {   
+typedef struct {
+    uint16_t literals;          // literal bytes before the match
+    uint16_t match_length;      // 0 = no match
+    uint32_t match_offset;
+} LZX_TOKEN;
+
+typedef struct {
+    uint32_t size;
+    uint32_t instr_pos;
+    uint32_t file_size;         // 0 = not translated
+} LZX_FRAME_INFO;           // a decoded frame waiting for e8 translation
+
+typedef struct {
+    LZX_TOKEN* tokens;
+    uint32_t token_count;
+    uint8_t* literals;
+    uint32_t literal_count;
+    uint32_t run;               // literals not yet in a token
+} LZX_TOKEN_BUFFER;
+
+typedef struct {
+    LZX_DECODER_CONTEXT* context;
+    const uint8_t* src;
+    LZX_FRAME_INFO* frames;
+    uint32_t first_frame;
+    uint32_t num_frames;
+    LZX_TOKEN_BUFFER* buffer;
+    int result;
+} LZX_PARSE_JOB;
+
+// the last bytes of the input, zero padded so the fast loops can finish a frame without checks.
+typedef struct {
+    uint8_t data[3 * SAFE_INPUT_BYTES];
+    const uint8_t* input_pos;   // where the copy was taken from
+    uint32_t input_size;        // input bytes in the copy
+    bool active;
+} LZX_INPUT_TAIL;
+
+static inline uint64_t load_bitbuf_words(const uint8_t* p) {
+    // four little endian 16 bit words, first word in the top bits.
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    x = (x << 32) | (x >> 32);
+    return ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+}
+static void init_bitbuf(LZX_DECODER_CONTEXT* context) {
     if (context->block_type == LZX_BLOCK_TYPE_UNCOMPRESSED)
         return;
 
-    if ((context->input_curpos + sizeof(uint32_t)) > context->end_input_pos)
-        return;
-
-    const uint8_t* p = context->input_curpos;
-    context->bitbuf = ((uint32_t)p[2] | (((uint32_t)p[3]) << 8)) | ((((uint32_t)p[0] | (((uint32_t)p[1]) << 8))) << 16);
-    context->bitcount = 16;
-    context->input_curpos += 4;
+    context->bitbuf = 0;
+    context->bitcount = 0;
+    REFILL_BITBUF(context->bitbuf, context->bitcount, context->input_curpos, context->end_input_pos);
+}
+static void rewind_bitbuf(LZX_DECODER_CONTEXT* context) {
+    // give back the whole words buffered after the current one; an uncompressed block starts
+    // at the next 16 bit boundary.
+    if (context->bitcount > 0)
+        context->input_curpos -= ((context->bitcount - 1) >> 4) << 1;
+    context->bitbuf = 0;
+    context->bitcount = 0;
 }
 static void fill_bitbuf(LZX_DECODER_CONTEXT* context, int n) {
     context->bitbuf <<= n;
     context->bitcount -= (char)n;
 
-    if (context->bitcount <= 0) {
-        if (context->input_curpos >= context->end_input_pos) {
-            context->error_condition = true;
-            return;
-        }
-
-        context->bitbuf |= ((((uint32_t)*context->input_curpos | (((uint32_t) * (context->input_curpos + 1)) << 8))) << (-context->bitcount));
-        context->input_curpos += 2;
-        context->bitcount += 16;
+    REFILL_BITBUF(context->bitbuf, context->bitcount, context->input_curpos, context->end_input_pos);
 
-        if (context->bitcount <= 0) {
-            if (context->input_curpos >= context->end_input_pos) {
-                context->error_condition = true;
-                return;
-            }
-
-            context->bitbuf |= ((((uint32_t)*context->input_curpos | (((uint32_t) * (context->input_curpos + 1)) << 8))) << (-context->bitcount));
-            context->input_curpos += 2;
-            context->bitcount += 16;
-        }
+    if (context->bitcount < 0) {
+        context->error_condition = true;
     }
 }
 
-static void decode_small(LZX_DECODER_CONTEXT* context, short* temp, short* small_table, uint32_t* mask, uint8_t* small_bitlen, short* leftright_s) {
-    *temp = small_table[context->bitbuf >> (32 - DS_TABLE_BITS)];
-    if (*temp < 0) {
-        
-        *mask = (1L << (32 - 1 - DS_TABLE_BITS));
-        
-        do {
-            *temp = -(*temp);
-            if (context->bitbuf & *mask)
-                *temp = leftright_s[2 * (*temp) + 1];
-            else
-                *temp = leftright_s[2 * (*temp)];
-            *mask >>= 1;
-        }
-        while (*temp < 0);
-    }
-    fill_bitbuf(context, small_bitlen[*temp]);
+static const uint8_t* begin_input_tail(LZX_INPUT_TAIL* tail, const uint8_t* curpos, const uint8_t* end) {
+    // move the rest of the input to the tail; returns where decoding continues.
+    tail->input_pos = curpos;
+    tail->input_size = (uint32_t)(end - curpos);
+    tail->active = true;
+    memset(tail->data, 0, sizeof(tail->data));
+    memcpy(tail->data, curpos, tail->input_size);
+    return tail->data;
+}
+
+static short decode_small(LZX_DECODER_CONTEXT* context, const uint32_t* small_table) {
+    uint32_t e;
+    TABLE_LOOKUP(small_table, DS_TABLE_BITS, context->bitbuf, e);
+    fill_bitbuf(context, TABLE_LEN(e));
+    return (short)TABLE_SYMBOL(e);
 }
 
 static uint32_t get_bits(LZX_DECODER_CONTEXT* context, int n) {
-    uint32_t value = context->bitbuf >> (32 - (n));
+    uint32_t value = (uint32_t)(context->bitbuf >> (64 - (n)));
     fill_bitbuf(context, n);
     return value;
 }
 static void translate_e8(LZX_DECODER_CONTEXT* context, uint8_t* mem, long bytes) {
-    uint32_t end_instr_pos;
-    uint8_t temp[6];
-    uint8_t* mem_backup;
-
-    if (bytes <= 6) {
-        context->instr_pos += bytes;
+    if (bytes <= 0)
         return;
-    }
-
-    mem_backup = mem;
-
-    memcpy(temp, &mem[bytes - 6], 6); // backup last 6 bytes
-    memset(&mem[bytes - 6], 0xE8, 6); // set last 6 bytes to 0xE8
-
-    end_instr_pos = context->instr_pos + bytes - 10;
-
-    while (1) {
-        uint32_t absolute;
-        uint32_t offset;
-
-        while (*mem++ != 0xE8)
-            context->instr_pos++;
-
-        if (context->instr_pos >= end_instr_pos)
-            break;
-
-        absolute = ((uint32_t)mem[0]) | (((uint32_t)mem[1]) << 8) | (((uint32_t)mem[2]) << 16) | (((uint32_t)mem[3]) << 24);
-
-        if (absolute < context->current_file_size) {
-            offset = absolute - context->instr_pos;
-            mem[0] = (uint8_t)(offset & 255);
-            mem[1] = (uint8_t)((offset >> 8) & 255);
-            mem[2] = (uint8_t)((offset >> 16) & 255);
-            mem[3] = (uint8_t)((offset >> 24) & 255);
-        }
-        else if ((uint32_t)(-(long)absolute) <= context->instr_pos) {
-            offset = absolute + context->current_file_size;
-            mem[0] = (uint8_t)(offset & 255);
-            mem[1] = (uint8_t)(offset >> 8) & 255;
-            mem[2] = (uint8_t)(offset >> 16) & 255;
-            mem[3] = (uint8_t)(offset >> 24) & 255;
-        }
 
-        mem += 4;
-        context->instr_pos += 5;
-    }
-
-    context->instr_pos = end_instr_pos + 10;
-
-    memcpy(&mem_backup[bytes - 6], temp, 6);
+    lzx_e8_decode(mem, (uint32_t)bytes, context->instr_pos, context->current_file_size);
+    context->instr_pos += bytes;
 }
 
-static bool make_table(int nchar, const uint8_t* bitlen, uint8_t tablebits, short* table, short* leftright) {
+static bool make_fast_table(int nchar, const uint8_t* bitlen, uint8_t tablebits, uint32_t* table, uint32_t table_size, bool pairs) {
+    // canonical codes of up to 16 bits. codes up to tablebits long are resolved by the first
+    // level; longer codes share a subtable per first level prefix, sized for the longest code
+    // under the prefix. with pairs, a first level literal whose following bits resolve a
+    // second literal decodes both.
+    uint32_t count[17] = { 0 };
+    uint32_t start[17] = { 0 };
+    uint32_t next_code[17];
+    uint8_t sub_bits[1 << MAIN_TREE_TABLE_BITS] = { 0 };
+    uint32_t sub_offset = 1 << tablebits;
+    uint32_t total = 0;
+    uint32_t code;
+    uint32_t first;
+    uint32_t last;
+    uint32_t e;
+    uint32_t e2;
     uint32_t i;
-    int ch;
-    short* p;
-    uint32_t count[17] = { 0} ;
-    uint32_t weight[17] = { 0 };
-    uint32_t start[18] = { 0 };
-    int avail;
-    uint32_t nextcode;
-    uint32_t k;
     uint8_t len;
-    uint8_t jutbits;
+    uint8_t extra;
+    int ch;
 
-    for (i = 0; i < (uint32_t)nchar; i++)
-        count[bitlen[i]]++;
+    for (ch = 0; ch < nchar; ch++)
+        count[bitlen[ch]]++;
 
     for (i = 1; i <= 16; i++)
-        start[i + 1] = start[i] + (count[i] << (16 - i));
+        total += count[i] << (16 - i);
 
-    if (start[17] != 65536) {
-        if (start[17] == 0) {
-            memset(table, 0, sizeof(uint16_t) * (1 << tablebits));
+    if (total != 65536) {
+        if (total == 0) {
+            for (i = 0; i < (1u << tablebits); i++)
+                table[i] = TABLE_ENTRY(0, 0);
             return true;
         }
         return false;
     }
 
-    jutbits = 16 - tablebits;
+    for (i = 2; i <= 16; i++)
+        start[i] = (start[i - 1] + count[i - 1]) << 1;
 
-    for (i = 1; i <= tablebits; i++) {
-        start[i] >>= jutbits;
-        weight[i] = 1 << (tablebits - i);
-    }
-    
-    while (i <= 16) {
-        weight[i] = 1 << (16 - i);
-        i++;
+    // size the subtables from the longest code under each prefix.
+    memcpy(next_code, start, sizeof(next_code));
+    for (ch = 0; ch < nchar; ch++) {
+        len = bitlen[ch];
+        if (len > tablebits) {
+            code = next_code[len]++;
+            if (sub_bits[code >> (len - tablebits)] < len - tablebits)
+                sub_bits[code >> (len - tablebits)] = len - tablebits;
+        }
     }
 
-    i = start[tablebits + 1] >> jutbits;
-
-    if (i != 65536) {
-        memset(&table[i], 0, sizeof(uint16_t) * ((1 << tablebits) - i));
+    // check the subtables fit before the table is touched; a rejected tree leaves the
+    // previous table whole.
+    for (i = 0; i < (1u << tablebits); i++) {
+        if (sub_bits[i] != 0)
+            sub_offset += 1 << sub_bits[i];
     }
+    if (sub_offset > table_size)
+        return false;
 
-    avail = nchar;
+    sub_offset = 1 << tablebits;
+    for (i = 0; i < (1u << tablebits); i++) {
+        if (sub_bits[i] != 0) {
+            table[i] = TABLE_SUBTABLE_ENTRY(sub_offset, sub_bits[i]);
+            sub_offset += 1 << sub_bits[i];
+        }
+    }
 
+    memcpy(next_code, start, sizeof(next_code));
     for (ch = 0; ch < nchar; ch++) {
         if ((len = bitlen[ch]) == 0)
             continue;
 
-        nextcode = start[len] + weight[len];
+        code = next_code[len]++;
 
         if (len <= tablebits) {
-            if (nextcode > (uint32_t) (1 << tablebits))
-                return false;
-
-            for (i = start[len]; i < nextcode; i++)
-                table[i] = (short)ch;
-
-            start[len] = nextcode;
+            first = code << (tablebits - len);
+            last = (code + 1) << (tablebits - len);
         }
         else {
-            k = start[len];
-            start[len] = nextcode;
-            p = &table[k >> jutbits];
-            i = len - tablebits;
-            k <<= tablebits;
+            e = table[code >> (len - tablebits)];
+            extra = (uint8_t)TABLE_SUB_BITS(e) - (len - tablebits);
+            code &= (1u << (len - tablebits)) - 1;
+            first = TABLE_SUB_OFFSET(e) + (code << extra);
+            last = TABLE_SUB_OFFSET(e) + ((code + 1) << extra);
+        }
 
-            do {
-                if (*p == 0) {
-                    leftright[avail * 2] = leftright[avail * 2 + 1] = 0;
-                    *p = (short)-avail;
-                    avail++;
-                }
+        for (i = first; i < last; i++)
+            table[i] = TABLE_ENTRY(ch, len);
+    }
 
-                if ((short)k < 0)
-                    p = &leftright[-(*p) * 2 + 1];
-                else
-                    p = &leftright[-(*p) * 2];
+    if (!pairs)
+        return true;
 
-                k <<= 1;
-                i--;
-            } 
-            while (i);
+    // a pair keeps the first symbol and its length, so a converted entry still reads as the
+    // literal it starts with.
+    for (i = 0; i < (1u << tablebits); i++) {
+        e = table[i];
+        if (TABLE_KIND(e) == TABLE_SUBTABLE || TABLE_SYMBOL(e) >= 256 || TABLE_LEN(e) >= tablebits)
+            continue;
 
-            *p = (short)ch;
-        }
+        e2 = table[(i << TABLE_LEN(e)) & ((1u << tablebits) - 1)];
+        if (TABLE_KIND(e2) == TABLE_SUBTABLE || TABLE_SYMBOL(e2) >= 256 || TABLE_LEN(e) + TABLE_LEN(e2) > tablebits)
+            continue;
+
+        table[i] = TABLE_PAIR_ENTRY(e, TABLE_SYMBOL(e2), TABLE_LEN(e) + TABLE_LEN(e2));
     }
 
     return true;
@@ -386,10 +464,8 @@ static bool make_table_8bit(uint8_t bitlen[], uint8_t table[]) {
 static bool read_rep_tree(LZX_DECODER_CONTEXT* context, int num_elements, uint8_t* lastlen, uint8_t* len) {
     int i;
     int consecutive;
-    uint32_t mask;
     uint8_t small_bitlen[24] = { 0 };
-    short small_table[1 << DS_TABLE_BITS];
-    short leftright_s[2 * (2 * 24 + 241)];
+    uint32_t small_table[DS_TABLE_SIZE];
     short temp;
 
     for (i = 0; i < NUM_DECODE_SMALL; i++) {
@@ -399,12 +475,13 @@ static bool read_rep_tree(LZX_DECODER_CONTEXT* context, int num_elements, uint8_
     if (context->error_condition)
         return false;
 
-    if (!make_table(NUM_DECODE_SMALL, small_bitlen, DS_TABLE_BITS, small_table, leftright_s)) {
+    if (!make_fast_table(NUM_DECODE_SMALL, small_bitlen, DS_TABLE_BITS, small_table, DS_TABLE_SIZE, false)) {
+        context->error_condition = true;
         return false;
     }
 
     for (i = 0; i < num_elements; i++) {
-        decode_small(context, &temp, small_table, &mask, small_bitlen, leftright_s);
+        temp = decode_small(context, small_table);
 
         if (context->error_condition)
             return false;
@@ -441,7 +518,7 @@ static bool read_rep_tree(LZX_DECODER_CONTEXT* context, int num_elements, uint8_
             if (i + consecutive >= num_elements)
                 consecutive = num_elements - i;
 
-            decode_small(context, &temp, small_table, &mask, small_bitlen, leftright_s);
+            temp = decode_small(context, small_table);
 
             value = (lastlen[i] - temp + 17) % 17;
 
@@ -466,8 +543,9 @@ static bool read_main_and_secondary_trees(LZX_DECODER_CONTEXT* context) {
         return false;
     }
 
-    if (!make_table(LZX_MAIN_TREE_ELEMENTS(context->num_position_slots), context->main_tree_len, MAIN_TREE_TABLE_BITS, 
-        context->main_tree_table, context->main_tree_left_right)) {
+    if (!make_fast_table(LZX_MAIN_TREE_ELEMENTS(context->num_position_slots), context->main_tree_len, MAIN_TREE_TABLE_BITS,
+        context->main_tree_table, MAIN_TREE_TABLE_SIZE, true)) {
+        context->error_condition = true;
         return false;
     }
 
@@ -475,8 +553,9 @@ static bool read_main_and_secondary_trees(LZX_DECODER_CONTEXT* context) {
         return false;
     }
 
-    if (!make_table(LZX_NUM_SECONDARY_LEN, context->secondary_len_tree_len, SECONDARY_LEN_TREE_TABLE_BITS, 
-        context->secondary_len_tree_table, context->secondary_len_tree_left_right)) {
+    if (!make_fast_table(LZX_NUM_SECONDARY_LEN, context->secondary_len_tree_len, SECONDARY_LEN_TREE_TABLE_BITS,
+        context->secondary_len_tree_table, SECONDARY_LEN_TREE_TABLE_SIZE, false)) {
+        context->error_condition = true;
         return false;
     }
 
@@ -492,32 +571,82 @@ static bool read_aligned_offset_tree(LZX_DECODER_CONTEXT* context) {
         return false;
 
     if (!make_table_8bit(context->aligned_len, (uint8_t*)context->aligned_table)) {
+        context->error_condition = true;
         return false;
     }
 
     return true;
 }
 
-static void copy_data_to_output(LZX_DECODER_CONTEXT* context, long amount, const uint8_t* data) {
+static void copy_data_to_output(LZX_DECODER_CONTEXT* context, long amount, long end) {
+    long wrapped = 0;
     if (context->output_buffer == NULL)
         return;
-    memcpy(context->output_buffer, data, amount);
+    // bytes carried in from the last frame can still be at the end of the window.
+    if (amount > end) {
+        wrapped = amount - end;
+        memcpy(context->output_buffer, &context->mem_window[context->window_size - wrapped], wrapped);
+    }
+    memcpy(context->output_buffer + wrapped, &context->mem_window[end - (amount - wrapped)], amount - wrapped);
     if ((context->current_file_size != 0) && (context->num_cfdata_frames < E8_CFDATA_FRAME_THRESHOLD)) {
         translate_e8(context, context->output_buffer, amount);
     }
 }
 
+static const uint8_t match_repeat_step[MATCH_COPY_SIZE] = {
+    0, 8, 8, 9, 8, 10, 12, 14
+};
+
+static inline void copy_match_word(uint8_t* dst, const uint8_t* src) {
+    uint64_t x;
+    memcpy(&x, src, sizeof(x));
+    memcpy(dst, &x, sizeof(x));
+}
+static inline void copy_match(uint8_t* dst, const uint8_t* src, int length, bool overcopy) {
+    // copy a match 8 bytes at a time. with overcopy the last copy may write up to 7 bytes past
+    // the match; only a linear window can allow that, a circular window still holds old data
+    // there that a later match may read.
+    uint8_t* const end = dst + length;
+
+    if (src < dst && dst - src < MATCH_COPY_SIZE) {
+        // a short period; write the first repeats one byte at a time, then copy from the
+        // multiple of the period that is at least 8 bytes back.
+        const uint8_t* start = dst;
+        const int step = match_repeat_step[dst - src];
+        while (dst < end && dst - start < step)
+            *dst++ = *src++;
+        src = dst - step;
+    }
+
+    if (overcopy) {
+        while (dst < end) {
+            copy_match_word(dst, src);
+            dst += MATCH_COPY_SIZE;
+            src += MATCH_COPY_SIZE;
+        }
+    }
+    else {
+        while (end - dst >= MATCH_COPY_SIZE) {
+            copy_match_word(dst, src);
+            dst += MATCH_COPY_SIZE;
+            src += MATCH_COPY_SIZE;
+        }
+        while (dst < end)
+            *dst++ = *src++;
+    }
+}
+
 static long decode_aligned_block_special(LZX_DECODER_CONTEXT* context, long pos, int amount_to_decode) {
     long pos_end;
     uint32_t match_pos;
     uint32_t temp_pos;
-    uint32_t dec_bitbuf;
+    uint64_t dec_bitbuf;
     int	match_length;
     int	c;
     const uint8_t* dec_input_curpos;
     const uint8_t* dec_end_input_pos;
     uint8_t* dec_mem_window;
-    char dec_bitcount;
+    int dec_bitcount;
     char m;
 
     dec_bitcount = context->bitcount;
@@ -602,15 +731,19 @@ static long decode_aligned_offset_block_fast(LZX_DECODER_CONTEXT* context, long
     long decode_residue;
     uint32_t match_pos;
     uint32_t temp_pos;
-    uint32_t dec_bitbuf;
+    uint64_t dec_bitbuf;
     int	match_length;
     int c;
     const uint8_t* dec_input_curpos;
     const uint8_t* dec_end_input_pos;
+    const uint8_t* dec_safe_input_pos;
     uint8_t* dec_mem_window;
     uint32_t match_ptr;
-    char dec_bitcount;
+    int dec_bitcount;
     char m;
+    const bool overcopy = context->linear_window;
+    LZX_INPUT_TAIL tail;
+    long stretch_end;
 
     dec_bitcount = context->bitcount;
     dec_bitbuf = context->bitbuf;
@@ -618,9 +751,23 @@ static long decode_aligned_offset_block_fast(LZX_DECODER_CONTEXT* context, long
     dec_end_input_pos = context->end_input_pos;
     dec_mem_window = context->mem_window;
     pos_end = pos + amount_to_decode;
+    tail.active = false;
+    stretch_end = pos;
+    NEXT_INPUT_STRETCH();
 
-    while (pos < pos_end) {
-        DECODE_MAIN_TREE(c);
+    for (;;) {
+        if (pos >= stretch_end) {
+            if (pos >= pos_end)
+                break;
+            if (dec_input_curpos > dec_safe_input_pos) {
+                if (tail.active)
+                    return -1; // input overflow
+                NEXT_INPUT_STRETCH();
+            }
+            stretch_end = STRETCH_END(dec_input_curpos, dec_safe_input_pos, pos, pos_end);
+        }
+
+        DECODE_MAIN_TREE_PAIR(c, &dec_mem_window[pos]);
 
         if ((c -= 256) < 0) {
             dec_mem_window[pos++] = (uint8_t)c;
@@ -645,7 +792,7 @@ static long decode_aligned_offset_block_fast(LZX_DECODER_CONTEXT* context, long
 
                     match_pos = match_pos_minus2[m] + (temp_pos << 3);
 
-                    DECODE_ALIGNED_NOEOFCHECK(temp_pos);
+                    DECODE_ALIGNED_FAST(temp_pos);
                     match_pos += temp_pos;
                 }
                 else {
@@ -671,16 +818,19 @@ static long decode_aligned_offset_block_fast(LZX_DECODER_CONTEXT* context, long
                 }
             }
 
+            if (match_pos > (uint32_t)pos && context->linear_window)
+                return -1;
+
             match_length += 2;
             match_ptr = (pos - match_pos) & context->window_mask;
 
-            do {
-                dec_mem_window[pos++] = dec_mem_window[match_ptr++];
-            } 
-            while (--match_length > 0);
+            copy_match(&dec_mem_window[pos], &dec_mem_window[match_ptr], match_length, overcopy);
+            pos += match_length;
         }
     }
 
+    END_INPUT_STRETCH();
+
     context->bitcount = dec_bitcount;
     context->bitbuf = dec_bitbuf;
     context->input_curpos = dec_input_curpos;
@@ -694,13 +844,15 @@ static long decode_aligned_offset_block_fast(LZX_DECODER_CONTEXT* context, long
 }
 static int decode_aligned_offset_block(LZX_DECODER_CONTEXT* context, long pos, int amount_to_decode)
 {
-    if (pos < 257) {        
+    if (pos < 257 && !context->linear_window) {
         long amount_to_slowly_decode = min(257 - pos, amount_to_decode);
         long new_pos = decode_aligned_block_special(context, pos, amount_to_slowly_decode);
+        if (new_pos < 0)
+            return -1;
         amount_to_decode -= (new_pos - pos);
         context->pos = pos = new_pos;
         if (amount_to_decode <= 0)
-            return amount_to_decode;
+            return -amount_to_decode;
     }
 
     return decode_aligned_offset_block_fast(context, pos, amount_to_decode);
@@ -709,13 +861,13 @@ static int decode_aligned_offset_block(LZX_DECODER_CONTEXT* context, long pos, i
 static long decode_verbatim_block_special(LZX_DECODER_CONTEXT* context, long pos, int amount_to_decode) {
     long pos_end;
     uint32_t match_pos;
-    uint32_t dec_bitbuf;
+    uint64_t dec_bitbuf;
     int match_length;
     int c;
     const uint8_t* dec_input_curpos;
     const uint8_t* dec_end_input_pos;
     uint8_t* dec_mem_window;
-    char dec_bitcount;
+    int dec_bitcount;
     char m;
 
     dec_bitcount = context->bitcount;
@@ -730,8 +882,8 @@ static long decode_verbatim_block_special(LZX_DECODER_CONTEXT* context, long pos
         DECODE_MAIN_TREE(c);
 
         if ((c -= 256) < 0) {
-            context->mem_window[pos] = (uint8_t)c;
-            context->mem_window[context->window_size + pos] = (uint8_t)c;
+            dec_mem_window[pos] = (uint8_t)c;
+            dec_mem_window[context->window_size + pos] = (uint8_t)c;
             pos++;
         }
         else {
@@ -743,7 +895,7 @@ static long decode_verbatim_block_special(LZX_DECODER_CONTEXT* context, long pos
 
             if (m > 2) {
                 if (m > 3) {
-                    GET_BITS17_NOEOFCHECK(lzx_extra_bits[m], match_pos);
+                    GET_BITS_NOEOFCHECK(lzx_extra_bits[m], match_pos);
                     match_pos += match_pos_minus2[m];
                 }
                 else {
@@ -765,10 +917,10 @@ static long decode_verbatim_block_special(LZX_DECODER_CONTEXT* context, long pos
             match_length += 2;
 
             do {
-                context->mem_window[pos] = context->mem_window[(pos - match_pos) & context->window_mask];
+                dec_mem_window[pos] = dec_mem_window[(pos - match_pos) & context->window_mask];
 
                 if (pos < 257)
-                    context->mem_window[context->window_size + pos] = context->mem_window[pos];
+                    dec_mem_window[context->window_size + pos] = dec_mem_window[pos];
 
                 pos++;
             }
@@ -787,14 +939,18 @@ static long decode_verbatim_block_fast(LZX_DECODER_CONTEXT* context, long pos, i
     long decode_residue;
     uint32_t match_pos;
     uint32_t match_ptr;
-    uint32_t dec_bitbuf;
+    uint64_t dec_bitbuf;
     int match_length;
     int c;
     const uint8_t* dec_input_curpos;
     const uint8_t* dec_end_input_pos;
+    const uint8_t* dec_safe_input_pos;
     uint8_t* dec_mem_window;
-    char dec_bitcount;
+    int dec_bitcount;
     char m;
+    const bool overcopy = context->linear_window;
+    LZX_INPUT_TAIL tail;
+    long stretch_end;
 
     dec_bitcount = context->bitcount;
     dec_bitbuf = context->bitbuf;
@@ -802,12 +958,26 @@ static long decode_verbatim_block_fast(LZX_DECODER_CONTEXT* context, long pos, i
     dec_end_input_pos = context->end_input_pos;
     dec_mem_window = context->mem_window;
     pos_end = pos + amount_to_decode;
+    tail.active = false;
+    stretch_end = pos;
+    NEXT_INPUT_STRETCH();
 
-    while (pos < pos_end) {
-        DECODE_MAIN_TREE(c); // decode an item from the main tree
+    for (;;) {
+        if (pos >= stretch_end) {
+            if (pos >= pos_end)
+                break;
+            if (dec_input_curpos > dec_safe_input_pos) {
+                if (tail.active)
+                    return -1; // input overflow
+                NEXT_INPUT_STRETCH();
+            }
+            stretch_end = STRETCH_END(dec_input_curpos, dec_safe_input_pos, pos, pos_end);
+        }
+
+        DECODE_MAIN_TREE_PAIR(c, &dec_mem_window[pos]); // decode an item, or a literal pair, from the main tree
 
         if ((c -= 256) < 0) {
-            context->mem_window[pos++] = (uint8_t)c;
+            dec_mem_window[pos++] = (uint8_t)c;
         }
         else {
             // get match length header
@@ -821,7 +991,7 @@ static long decode_verbatim_block_fast(LZX_DECODER_CONTEXT* context, long pos, i
             // read any extra bits for the match position
             if (m > 2) {
                 if (m > 3) {
-                    GET_BITS17_NOEOFCHECK(lzx_extra_bits[m], match_pos);
+                    GET_BITS_NOEOFCHECK(lzx_extra_bits[m], match_pos);
                     match_pos += match_pos_minus2[m];
                 }
                 else {
@@ -840,16 +1010,19 @@ static long decode_verbatim_block_fast(LZX_DECODER_CONTEXT* context, long pos, i
                 }
             }
 
+            if (match_pos > (uint32_t)pos && context->linear_window)
+                return -1;
+
             match_length += 2;
             match_ptr = (pos - match_pos) & context->window_mask;
 
-            do {
-                context->mem_window[pos++] = context->mem_window[match_ptr++];
-            } 
-            while (--match_length > 0);
+            copy_match(&dec_mem_window[pos], &dec_mem_window[match_ptr], match_length, overcopy);
+            pos += match_length;
         }
     }
 
+    END_INPUT_STRETCH();
+
     context->bitcount = dec_bitcount;
     context->bitbuf = dec_bitbuf;
     context->input_curpos = dec_input_curpos;
@@ -863,16 +1036,18 @@ static long decode_verbatim_block_fast(LZX_DECODER_CONTEXT* context, long pos, i
 }
 static int decode_verbatim_block(LZX_DECODER_CONTEXT* context, long pos, int amount_to_decode) {
 
-    if (pos < 257) {
+    if (pos < 257 && !context->linear_window) {
 
         long amount_to_slowly_decode = min(257 - pos, amount_to_decode);
         long new_pos = decode_verbatim_block_special(context, pos, amount_to_slowly_decode);
+        if (new_pos < 0)
+            return -1;
 
         amount_to_decode -= (new_pos - pos);
         context->pos = pos = new_pos;
 
         if (amount_to_decode <= 0)
-            return amount_to_decode;
+            return -amount_to_decode;
     }
 
     return decode_verbatim_block_fast(context, pos, amount_to_decode);
@@ -899,7 +1074,7 @@ static int decode_uncompressed_block(LZX_DECODER_CONTEXT* context, long pos, int
 
     context->input_curpos = p;
 
-    end_copy_pos = min(257, pos_end);
+    end_copy_pos = context->linear_window ? 0 : min(257, pos_end);
 
     while (pos_start < end_copy_pos) {
         context->mem_window[pos_start + context->window_size] =
@@ -915,10 +1090,151 @@ static int decode_uncompressed_block(LZX_DECODER_CONTEXT* context, long pos, int
     return (int)decode_residue;
 }
 
-static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode) {
+static void emit_token(LZX_TOKEN_BUFFER* buffer, uint32_t match_length, uint32_t match_offset) {
+    LZX_TOKEN* token = &buffer->tokens[buffer->token_count++];
+    token->literals = (uint16_t)buffer->run;
+    token->match_length = (uint16_t)match_length;
+    token->match_offset = match_offset;
+    buffer->run = 0;
+}
+static long decode_compressed_block_tokens(LZX_DECODER_CONTEXT* context, LZX_TOKEN_BUFFER* buffer, int amount_to_decode) {
+    // decode a verbatim or aligned block into tokens instead of the window.
+    long pos;
+    uint32_t match_pos;
+    uint32_t temp_pos;
+    uint64_t dec_bitbuf;
+    int match_length;
+    int c;
+    const uint8_t* dec_input_curpos;
+    const uint8_t* dec_end_input_pos;
+    const uint8_t* dec_safe_input_pos;
+    int dec_bitcount;
+    char m;
+    const bool aligned = (context->block_type == LZX_BLOCK_TYPE_ALIGNED);
+    LZX_INPUT_TAIL tail;
+    long stretch_end;
+
+    dec_bitcount = context->bitcount;
+    dec_bitbuf = context->bitbuf;
+    dec_input_curpos = context->input_curpos;
+    dec_end_input_pos = context->end_input_pos;
+    pos = 0;
+    tail.active = false;
+    stretch_end = pos;
+    NEXT_INPUT_STRETCH();
+
+    for (;;) {
+        uint32_t e;
+
+        if (pos >= stretch_end) {
+            if (pos >= amount_to_decode)
+                break;
+            if (dec_input_curpos > dec_safe_input_pos) {
+                if (tail.active)
+                    return -1; // input overflow
+                NEXT_INPUT_STRETCH();
+            }
+            stretch_end = STRETCH_END(dec_input_curpos, dec_safe_input_pos, pos, amount_to_decode);
+        }
+
+        FILL_BUF_FAST();
+        TABLE_LOOKUP(context->main_tree_table, MAIN_TREE_TABLE_BITS, dec_bitbuf, e);
+
+        if (TABLE_KIND(e) == TABLE_PAIR && pos + 1 < stretch_end) {
+            buffer->literals[buffer->literal_count++] = (uint8_t)TABLE_SYMBOL(e);
+            buffer->literals[buffer->literal_count++] = TABLE_PAIR_LITERAL(e);
+            buffer->run += 2;
+            pos += 2;
+            DROP_BITS(TABLE_PAIR_LEN(e));
+            continue;
+        }
+
+        c = TABLE_SYMBOL(e);
+        DROP_BITS(TABLE_LEN(e));
+
+        if ((c -= 256) < 0) {
+            buffer->literals[buffer->literal_count++] = (uint8_t)c;
+            buffer->run++;
+            pos++;
+            continue;
+        }
+
+        if ((match_length = c & LZX_NUM_PRIMARY_LEN) == LZX_NUM_PRIMARY_LEN) {
+            DECODE_LEN_TREE_NOEOFCHECK(match_length);
+        }
+
+        m = (char)(c >> 3);
+
+        if (m > 2) {
+            if (aligned && lzx_extra_bits[m] >= 3) {
+                if (lzx_extra_bits[m] - 3) {
+                    GET_BITS_NOEOFCHECK(lzx_extra_bits[m] - 3, temp_pos);
+                }
+                else {
+                    temp_pos = 0;
+                }
+
+                match_pos = match_pos_minus2[m] + (temp_pos << 3);
+
+                DECODE_ALIGNED_FAST(temp_pos);
+                match_pos += temp_pos;
+            }
+            else if (lzx_extra_bits[m]) {
+                GET_BITS_NOEOFCHECK(lzx_extra_bits[m], match_pos);
+                match_pos += match_pos_minus2[m];
+            }
+            else {
+                match_pos = match_pos_minus2[m];
+            }
+
+            context->last_matchpos_offset[2] = context->last_matchpos_offset[1];
+            context->last_matchpos_offset[1] = context->last_matchpos_offset[0];
+            context->last_matchpos_offset[0] = match_pos;
+        }
+        else {
+            match_pos = context->last_matchpos_offset[m];
+            if (m) {
+                context->last_matchpos_offset[m] = context->last_matchpos_offset[0];
+                context->last_matchpos_offset[0] = match_pos;
+            }
+        }
+
+        match_length += 2;
+        emit_token(buffer, match_length, match_pos);
+        pos += match_length;
+    }
+
+    END_INPUT_STRETCH();
+
+    context->bitcount = dec_bitcount;
+    context->bitbuf = dec_bitbuf;
+    context->input_curpos = dec_input_curpos;
+
+    return pos - amount_to_decode;
+}
+static long decode_uncompressed_block_tokens(LZX_DECODER_CONTEXT* context, LZX_TOKEN_BUFFER* buffer, int amount_to_decode) {
+    if (context->input_curpos + amount_to_decode > context->end_input_pos)
+        return -1; // input overflow
+
+    memcpy(&buffer->literals[buffer->literal_count], context->input_curpos, amount_to_decode);
+    context->input_curpos += amount_to_decode;
+    buffer->literal_count += amount_to_decode;
+    buffer->run += amount_to_decode;
+
+    return 0;
+}
+
+static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode, LZX_TOKEN_BUFFER* tokens, LZX_FRAME_INFO* frame) {
     int amount_can_decode;
     int total_decoded = 0;
 
+    // the start of the frame was already decoded by a match at the end of the last one.
+    if (context->frame_residue > 0) {
+        total_decoded = min(context->frame_residue, bytes_to_decode);
+        context->frame_residue -= total_decoded;
+        bytes_to_decode -= total_decoded;
+    }
+
     while (bytes_to_decode > 0) {
         if (context->decoder_state == DEC_STATE_NEW_BLOCK) {
             uint32_t temp1;
@@ -963,19 +1279,21 @@ static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode) {
 
             switch (context->block_type) {
                 case LZX_BLOCK_TYPE_ALIGNED:
-                    read_aligned_offset_tree(context);
+                    if (!read_aligned_offset_tree(context))
+                        return -1;
                     // fall through to VERBATIM
 
                 case LZX_BLOCK_TYPE_VERBATIM:
                     memcpy(context->main_tree_prev_len, context->main_tree_len, LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
                     memcpy(context->secondary_len_tree_prev_len, context->secondary_len_tree_len, LZX_NUM_SECONDARY_LEN);
-                    read_main_and_secondary_trees(context);
+                    if (!read_main_and_secondary_trees(context))
+                        return -1;
                     break;
 
                 case LZX_BLOCK_TYPE_UNCOMPRESSED: {
                     int i;
-                    context->input_curpos -= 2;
-                    if (context->input_curpos + 4 >= context->end_input_pos)
+                    rewind_bitbuf(context);
+                    if (context->end_input_pos - context->input_curpos < 4 * LZX_NUM_REPEATED_OFFSETS)
                         return -1;
                     for (i = 0; i < LZX_NUM_REPEATED_OFFSETS; i++) {
                         context->last_matchpos_offset[i] =
@@ -992,6 +1310,10 @@ static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode) {
                     return -1;
             }
 
+            // the block header and trees ran past the end of the frame.
+            if (context->error_condition)
+                return -1;
+
             context->decoder_state = DEC_STATE_DECODING;
         }
 
@@ -999,26 +1321,57 @@ static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode) {
             int decode_residue;
 
             amount_can_decode = min(context->block_size, bytes_to_decode);
+
+            // a circular window is decoded up to its end, then from the start again.
+            if (tokens == NULL && !context->linear_window)
+                amount_can_decode = min(amount_can_decode, (long)context->window_size - context->pos);
+
             if (amount_can_decode == 0)
                 return -1;
 
-            switch (context->block_type) {
-                case LZX_BLOCK_TYPE_ALIGNED:
-                    decode_residue = decode_aligned_offset_block(context, context->pos, amount_can_decode);
-                    break;
-                case LZX_BLOCK_TYPE_VERBATIM:
-                    decode_residue = decode_verbatim_block(context, context->pos, amount_can_decode);
-                    break;
-                case LZX_BLOCK_TYPE_UNCOMPRESSED:
-                    decode_residue = decode_uncompressed_block(context, context->pos, amount_can_decode);
-                    break;
-                default:
-                    return -1;
+            if (tokens != NULL) {
+                if (context->block_type == LZX_BLOCK_TYPE_UNCOMPRESSED)
+                    decode_residue = decode_uncompressed_block_tokens(context, tokens, amount_can_decode);
+                else
+                    decode_residue = decode_compressed_block_tokens(context, tokens, amount_can_decode);
+            }
+            else {
+                switch (context->block_type) {
+                    case LZX_BLOCK_TYPE_ALIGNED:
+                        decode_residue = decode_aligned_offset_block(context, context->pos, amount_can_decode);
+                        break;
+                    case LZX_BLOCK_TYPE_VERBATIM:
+                        decode_residue = decode_verbatim_block(context, context->pos, amount_can_decode);
+                        break;
+                    case LZX_BLOCK_TYPE_UNCOMPRESSED:
+                        decode_residue = decode_uncompressed_block(context, context->pos, amount_can_decode);
+                        break;
+                    default:
+                        return -1;
+                }
             }
 
-            context->block_size -= amount_can_decode;
-            bytes_to_decode -= amount_can_decode;
-            total_decoded += amount_can_decode;
+            if (decode_residue < 0)
+                return -1;
+
+            // a match may run past the end of what was asked for, but not past the end of its block.
+            if (decode_residue > context->block_size - amount_can_decode)
+                return -1;
+
+            // the match ran off the end of a circular window into its slack.
+            if (!context->linear_window && context->pos < decode_residue)
+                memcpy(context->mem_window, &context->mem_window[context->window_size], context->pos);
+
+            context->block_size -= amount_can_decode + decode_residue;
+
+            // the bytes a match wrote beyond the end of the frame count towards the next frame.
+            if (decode_residue > bytes_to_decode - amount_can_decode) {
+                context->frame_residue += decode_residue - (bytes_to_decode - amount_can_decode);
+                decode_residue = bytes_to_decode - amount_can_decode;
+            }
+
+            bytes_to_decode -= amount_can_decode + decode_residue;
+            total_decoded += amount_can_decode + decode_residue;
         }
 
         if (context->block_size == 0) {
@@ -1030,15 +1383,49 @@ static long decode_data(LZX_DECODER_CONTEXT* context, int bytes_to_decode) {
         }
     }
 
-    long temp = context->pos;
-    if (!temp) {
-        temp = context->window_size;
+    if (tokens != NULL && tokens->run != 0) {
+        emit_token(tokens, 0, 0);
     }
 
-    copy_data_to_output(context, total_decoded, &context->mem_window[temp - total_decoded]);
+    if (frame != NULL) {
+        // the frame is translated by the caller once it is out of the window.
+        frame->size = total_decoded;
+        frame->instr_pos = 0;
+        frame->file_size = 0;
+        if ((context->current_file_size != 0) && (context->num_cfdata_frames < E8_CFDATA_FRAME_THRESHOLD)) {
+            frame->instr_pos = context->instr_pos;
+            frame->file_size = context->current_file_size;
+            context->instr_pos += total_decoded;
+        }
+
+        return total_decoded;
+    }
+
+    long temp = context->pos - context->frame_residue;
+    if (temp <= 0) {
+        temp += context->window_size;
+    }
+
+    copy_data_to_output(context, total_decoded, temp);
 
     return total_decoded;
 }
+static void decode_reset(LZX_DECODER_CONTEXT* context);
+
+static void set_window(LZX_DECODER_CONTEXT* context, uint8_t* window) {
+    // decode into the caller's buffer as one linear window, or into the decoder's own circular window.
+    if (window != NULL) {
+        context->mem_window = window;
+        context->window_mask = 0xFFFFFFFF;
+        context->linear_window = true;
+    }
+    else {
+        context->mem_window = context->window_buffer;
+        context->window_mask = context->window_size - 1;
+        context->linear_window = false;
+    }
+}
+
 static bool decode_init(LZX_DECODER_CONTEXT* context) {
     uint32_t pos_start = 4;
 
@@ -1054,30 +1441,30 @@ static bool decode_init(LZX_DECODER_CONTEXT* context) {
     }
 
     // alloc mem window
-    context->mem_window = (uint8_t*)malloc(context->window_size + (LZX_MAX_MATCH + 4));
-    if (context->mem_window == NULL) {
+    context->window_buffer = (uint8_t*)malloc(context->window_size + WINDOW_SLACK);
+    if (context->window_buffer == NULL) {
         return false;
     }
 
-    // alloc input buffer
-    context->input_buffer = (uint8_t*)malloc(LZX_OUTPUT_SIZE);
-    if (context->input_buffer == NULL) {
-        free(context->mem_window);
-        context->mem_window = NULL;
-        return false;
-    }
+    set_window(context, NULL);
+    decode_reset(context);
 
+    return true;
+}
+static void decode_reset(LZX_DECODER_CONTEXT* context) {
     // reset decoder state
     memset(context->main_tree_len, 0, LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
     memset(context->main_tree_prev_len, 0, LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
     memset(context->secondary_len_tree_len, 0, LZX_NUM_SECONDARY_LEN);
     memset(context->secondary_len_tree_prev_len, 0, LZX_NUM_SECONDARY_LEN);
+    memset(context->aligned_len, 0, LZX_ALIGNED_NUM_ELEMENTS);
 
     // init decoder state
     context->last_matchpos_offset[0] = 1;
     context->last_matchpos_offset[1] = 1;
     context->last_matchpos_offset[2] = 1;
     context->pos = 0;
+    context->frame_residue = 0;
     context->position_at_start = 0;
     context->decoder_state = DEC_STATE_NEW_BLOCK;
     context->block_size = 0;
@@ -1087,40 +1474,6 @@ static bool decode_init(LZX_DECODER_CONTEXT* context) {
     context->error_condition = false;
     context->instr_pos = 0;
     context->num_cfdata_frames = 0;
-
-    return true;
-}
-
-static int lzx_check_buffer_resize(uint8_t** buffer, uint8_t** buffer_ptr, uint32_t* buffer_size, uint32_t required_size, uint32_t allocation_size) {
-    // Check to see if we have enough space in the output buffer
-
-    uint8_t* new_buffer = NULL;
-    uint32_t offset = 0;
-
-    if (required_size == 0) {
-        return LZX_ERROR_INVALID_DATA;
-    }
-
-    // if allocation size is not provided or less than the allocation_size, use required size
-    if (allocation_size < required_size) {
-        allocation_size = required_size;
-    }
-
-    // check buffer size
-    if (*buffer_ptr + required_size > *buffer + *buffer_size) {
-        offset = *buffer_ptr - *buffer;
-        new_buffer = (uint8_t*)realloc(*buffer, *buffer_size + allocation_size);
-        if (new_buffer == NULL) {
-            return LZX_ERROR_OUT_OF_MEMORY;
-        }
-
-        // update buffer pointers.
-        *buffer = new_buffer;
-        *buffer_ptr = (*buffer + offset);
-        *buffer_size += allocation_size;
-    }
-
-    return 0;
 }
 
 LZX_DECODER_CONTEXT* lzx_create_decompression() {
@@ -1138,23 +1491,20 @@ LZX_DECODER_CONTEXT* lzx_create_decompression() {
 }
 void lzx_destroy_decompression(LZX_DECODER_CONTEXT* context) {
     if (context != NULL) {
-        if (context->mem_window != NULL)
+        if (context->window_buffer != NULL)
         {
-            free(context->mem_window);
-            context->mem_window = NULL;
-        }
-
-        if (context->input_buffer != NULL)
-        {
-            free(context->input_buffer);
-            context->input_buffer = NULL;
+            free(context->window_buffer);
+            context->window_buffer = NULL;
         }
 
         free(context);
     }
 }
+void lzx_reset_decompression(LZX_DECODER_CONTEXT* context) {
+    decode_reset(context);
+}
 
-int lzx_decompress_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint32_t bytes_compressed, uint8_t* dest, uint32_t* bytes_decompressed) {
+static int decode_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint32_t bytes_compressed, uint8_t* dest, uint32_t* bytes_decompressed, LZX_TOKEN_BUFFER* tokens, LZX_FRAME_INFO* frame) {
     uint32_t bytes_encoded;
     long bytes_decoded;
 
@@ -1166,18 +1516,16 @@ int lzx_decompress_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint3
         return LZX_ERROR_BUFFER_OVERFLOW;
     }
 
-    // copy src into input buffer
-    memcpy(context->input_buffer, src, bytes_compressed);
-
-    context->input_curpos = context->input_buffer;
-    context->end_input_pos = (context->input_buffer + bytes_compressed + 4);
+    // the bit reader never reads past the frame, so decode it in place.
+    context->input_curpos = src;
+    context->end_input_pos = src + bytes_compressed;
 
     context->output_buffer = dest;
 
     init_bitbuf(context);
 
     bytes_encoded = *bytes_decompressed;
-    bytes_decoded = decode_data(context, bytes_encoded);
+    bytes_decoded = decode_data(context, bytes_encoded, tokens, frame);
 
     context->num_cfdata_frames++;
 
@@ -1190,6 +1538,9 @@ int lzx_decompress_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint3
     context->position_at_start += bytes_decoded;
     return 0;
 }
+int lzx_decompress_block(LZX_DECODER_CONTEXT* context, const uint8_t* src, uint32_t bytes_compressed, uint8_t* dest, uint32_t* bytes_decompressed) {
+    return decode_block(context, src, bytes_compressed, dest, bytes_decompressed, NULL, NULL);
+}
 int lzx_decompress_next_block(LZX_DECODER_CONTEXT* context, const uint8_t** src, uint32_t* bytes_compressed, uint8_t** dest, uint32_t* bytes_decompressed) {
     int result;
     LZX_BLOCK* block = (LZX_BLOCK*)*src;
@@ -1206,29 +1557,169 @@ int lzx_decompress_next_block(LZX_DECODER_CONTEXT* context, const uint8_t** src,
     return result;
 }
 
-int lzx_decompress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size) {
+static int scan_frames(const uint8_t* src, uint32_t src_size, uint32_t* num_frames, uint32_t* total_size) {
+    // walk the frame headers; count the frames and the decompressed size.
+    const uint8_t* src_ptr = src;
+    LZX_BLOCK* block;
+
+    *num_frames = 0;
+    *total_size = 0;
+
+    while ((uint32_t)(src_ptr - src) < src_size) {
+        if ((uint32_t)(src_ptr - src) + sizeof(LZX_BLOCK) > src_size)
+            return LZX_ERROR_INVALID_DATA;
+
+        block = (LZX_BLOCK*)src_ptr;
+        if (block->uncompressed_size > LZX_CHUNK_SIZE || block->compressed_size > LZX_OUTPUT_SIZE)
+            return LZX_ERROR_BUFFER_OVERFLOW;
+
+        src_ptr += sizeof(LZX_BLOCK) + block->compressed_size;
+        if ((uint32_t)(src_ptr - src) > src_size)
+            return LZX_ERROR_INVALID_DATA;
+
+        // the total and its window slack must fit in 32 bits.
+        if (block->uncompressed_size > UINT32_MAX - WINDOW_SLACK - *total_size)
+            return LZX_ERROR_INVALID_DATA;
+
+        *total_size += block->uncompressed_size;
+        (*num_frames)++;
+    }
+
+    return 0;
+}
+static void translate_frames(const LZX_FRAME_INFO* frames, uint32_t* frame, uint32_t* frame_pos, uint32_t end_frame, uint8_t* dest, uint32_t safe_pos) {
+    // e8 translate the replayed frames that no later match can read.
+    while (*frame < end_frame && *frame_pos + frames[*frame].size <= safe_pos) {
+        if (frames[*frame].file_size != 0)
+            lzx_e8_decode(dest + *frame_pos, frames[*frame].size, frames[*frame].instr_pos, frames[*frame].file_size);
+        *frame_pos += frames[*frame].size;
+        (*frame)++;
+    }
+}
+int lzx_get_decompressed_size(const uint8_t* src, const uint32_t src_size, uint32_t* decompressed_size) {
+    uint32_t num_frames = 0;
+    uint32_t total_size = 0;
+    int result;
+
+    result = scan_frames(src, src_size, &num_frames, &total_size);
+    if (result != 0) {
+        return result;
+    }
+
+    *decompressed_size = total_size;
+    return 0;
+}
+uint32_t lzx_decompress_bound(const uint32_t decompressed_size) {
+    return decompressed_size + WINDOW_SLACK;
+}
+
+int lzx_decompress_ctx(LZX_DECODER_CONTEXT* context, const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size) {
+    LZX_FRAME_INFO* frames = NULL;
+    LZX_BLOCK* block = NULL;
     const uint8_t* src_ptr = NULL;
-    uint8_t* dest_ptr = NULL;
-    LZX_DECODER_CONTEXT* context = NULL;
-    uint32_t bytes_decompressed = 0;
-    uint32_t bytes_compressed = 0;
-    uint32_t total_decompressed_size = 0;
+    uint8_t* new_dest = NULL;
+    uint32_t num_frames = 0;
+    uint32_t total_size = 0;
     uint32_t allocated_size = 0;
+    uint32_t bytes_decompressed = 0;
+    uint32_t dest_pos = 0;
+    uint32_t frame = 0;
+    uint32_t frame_pos = 0;
+    uint32_t i;
     int result = 0;
 
+    result = scan_frames(src, src_size, &num_frames, &total_size);
+    if (result != 0) {
+        return result;
+    }
+
     if (dest_size != NULL) {
         allocated_size = *dest_size;
     }
 
-    // Allocate a buffer if one was not provided
     if (*dest == NULL) {
-        *dest = (uint8_t*)malloc(LZX_CHUNK_SIZE);
-        if (*dest == NULL)
-        {
-            result = LZX_ERROR_OUT_OF_MEMORY;
+        allocated_size = 0;
+    }
+
+    // the output buffer is the window; a bad match can run past the last frame before it is rejected.
+    if (allocated_size < lzx_decompress_bound(total_size)) {
+        new_dest = (uint8_t*)realloc(*dest, lzx_decompress_bound(total_size));
+        if (new_dest == NULL) {
+            return LZX_ERROR_OUT_OF_MEMORY;
+        }
+        *dest = new_dest;
+        allocated_size = lzx_decompress_bound(total_size);
+    }
+
+    if (dest_size != NULL) {
+        *dest_size = allocated_size;
+    }
+
+    frames = (LZX_FRAME_INFO*)malloc(sizeof(LZX_FRAME_INFO) * max(num_frames, 1));
+    if (frames == NULL) {
+        return LZX_ERROR_OUT_OF_MEMORY;
+    }
+
+    lzx_reset_decompression(context);
+    set_window(context, *dest);
+
+    src_ptr = src;
+    for (i = 0; i < num_frames; i++) {
+        block = (LZX_BLOCK*)src_ptr;
+        src_ptr += sizeof(LZX_BLOCK);
+
+        bytes_decompressed = block->uncompressed_size;
+        result = decode_block(context, src_ptr, block->compressed_size, NULL, &bytes_decompressed, NULL, &frames[i]);
+        if (result != 0) {
+            goto Cleanup;
+        }
+
+        if (bytes_decompressed != block->uncompressed_size) {
+            result = LZX_ERROR_INVALID_DATA;
             goto Cleanup;
         }
-        allocated_size = LZX_CHUNK_SIZE;
+
+        src_ptr += block->compressed_size;
+        dest_pos += bytes_decompressed;
+
+        // e8 translation rewrites the output, so it waits until no match can reach the frame.
+        translate_frames(frames, &frame, &frame_pos, i + 1, *dest, (dest_pos > LZX_WINDOW_SIZE) ? dest_pos - LZX_WINDOW_SIZE : 0);
+    }
+
+    translate_frames(frames, &frame, &frame_pos, num_frames, *dest, total_size);
+
+    if (decompressed_size != NULL) {
+        *decompressed_size = total_size;
+    }
+
+Cleanup:
+
+    set_window(context, NULL);
+
+    if (frames != NULL) {
+        free(frames);
+        frames = NULL;
+    }
+
+    return result;
+}
+
+int lzx_decompress_fd(int in_fd, int out_fd, uint32_t* compressed_size, uint32_t* decompressed_size) {
+    LZX_DECODER_CONTEXT* context = NULL;
+    LZX_BLOCK block;
+    uint8_t* frame = NULL;
+    uint8_t* output = NULL;
+    uint32_t total_read = 0;
+    uint32_t total_written = 0;
+    uint32_t bytes_decompressed = 0;
+    int bytes_read = 0;
+    int result = 0;
+
+    frame = (uint8_t*)malloc(LZX_OUTPUT_SIZE);
+    output = (uint8_t*)malloc(LZX_CHUNK_SIZE);
+    if (frame == NULL || output == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
     }
 
     // Create a decompression context
@@ -1238,32 +1729,85 @@ int lzx_decompress(const uint8_t* src, const uint32_t src_size, uint8_t** dest,
         goto Cleanup;
     }
 
-    src_ptr = src;
-    dest_ptr = *dest;
-
     for (;;) {
-        if ((uint32_t)(src_ptr - src) >= src_size) {
-            result = 0;
+        // read the frame header
+        bytes_read = readFd(in_fd, &block, sizeof(LZX_BLOCK));
+        if (bytes_read == 0) {
             break;
         }
+        if (bytes_read != sizeof(LZX_BLOCK)) {
+            result = (bytes_read < 0) ? LZX_ERROR_IO : LZX_ERROR_INVALID_DATA;
+            goto Cleanup;
+        }
 
-        // realloc output buffer if needed; allocate 10 times the chunk size so we don't have to realloc too often
-        result = lzx_check_buffer_resize(dest, &dest_ptr, &allocated_size, LZX_CHUNK_SIZE, LZX_CHUNK_SIZE * 10);
-        if (result != 0) {
+        if (block.compressed_size > LZX_OUTPUT_SIZE) {
+            result = LZX_ERROR_BUFFER_OVERFLOW;
             goto Cleanup;
         }
 
-        result = lzx_decompress_next_block(context, &src_ptr, &bytes_compressed, &dest_ptr, &bytes_decompressed);
+        // read the frame data
+        bytes_read = readFd(in_fd, frame, block.compressed_size);
+        if (bytes_read != block.compressed_size) {
+            result = (bytes_read < 0) ? LZX_ERROR_IO : LZX_ERROR_INVALID_DATA;
+            goto Cleanup;
+        }
+
+        total_read += sizeof(LZX_BLOCK) + block.compressed_size;
+
+        bytes_decompressed = block.uncompressed_size;
+        result = lzx_decompress_block(context, frame, block.compressed_size, output, &bytes_decompressed);
         if (result != 0) {
             goto Cleanup;
         }
 
-        total_decompressed_size += bytes_decompressed;
+        if (writeFd(out_fd, output, bytes_decompressed) != 0) {
+            result = LZX_ERROR_IO;
+            goto Cleanup;
+        }
+
+        total_written += bytes_decompressed;
+    }
+
+    if (compressed_size != NULL) {
+        *compressed_size = total_read;
     }
 
     if (decompressed_size != NULL) {
-        *decompressed_size = total_decompressed_size;
+        *decompressed_size = total_written;
     }
+
+Cleanup:
+
+    if (context != NULL) {
+        lzx_destroy_decompression(context);
+        context = NULL;
+    }
+
+    if (frame != NULL) {
+        free(frame);
+        frame = NULL;
+    }
+
+    if (output != NULL) {
+        free(output);
+        output = NULL;
+    }
+
+    return result;
+}
+
+int lzx_decompress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size) {
+    LZX_DECODER_CONTEXT* context = NULL;
+    int result = 0;
+
+    // Create a decompression context
+    context = lzx_create_decompression();
+    if (context == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    result = lzx_decompress_ctx(context, src, src_size, dest, dest_size, decompressed_size);
         
 Cleanup:
 
@@ -1274,3 +1818,307 @@ Cleanup:
 
     return result;
 }
+
+static void parse_frames(void* arg) {
+    // stage one; decode a batch of frames into tokens.
+    LZX_PARSE_JOB* job = (LZX_PARSE_JOB*)arg;
+    LZX_BLOCK* block;
+    uint32_t bytes_decompressed;
+    uint32_t i;
+
+    job->buffer->token_count = 0;
+    job->buffer->literal_count = 0;
+    job->buffer->run = 0;
+
+    for (i = 0; i < job->num_frames; i++) {
+        block = (LZX_BLOCK*)job->src;
+        job->src += sizeof(LZX_BLOCK);
+
+        bytes_decompressed = block->uncompressed_size;
+        job->result = decode_block(job->context, job->src, block->compressed_size, NULL, &bytes_decompressed, job->buffer, &job->frames[job->first_frame + i]);
+        if (job->result != 0)
+            return;
+
+        if (bytes_decompressed != block->uncompressed_size) {
+            job->result = LZX_ERROR_INVALID_DATA;
+            return;
+        }
+
+        job->src += block->compressed_size;
+    }
+
+    job->result = 0;
+}
+static int replay_tokens(const LZX_TOKEN_BUFFER* buffer, uint8_t* dest, uint32_t* dest_pos, uint32_t dest_size) {
+    // stage two; copy the literals and matches of a batch into the output.
+    const LZX_TOKEN* token;
+    const uint8_t* literals = buffer->literals;
+    uint8_t* out = dest + *dest_pos;
+    const uint8_t* match;
+    uint32_t length;
+    uint32_t i;
+
+    for (i = 0; i < buffer->token_count; i++) {
+        token = &buffer->tokens[i];
+
+        if ((uint32_t)(out - dest) + token->literals + token->match_length > dest_size)
+            return LZX_ERROR_BUFFER_OVERFLOW;
+
+        memcpy(out, literals, token->literals);
+        out += token->literals;
+        literals += token->literals;
+
+        length = token->match_length;
+        if (length == 0)
+            continue;
+
+        if (token->match_offset > (uint32_t)(out - dest))
+            return LZX_ERROR_INVALID_DATA;
+
+        match = out - token->match_offset;
+        copy_match(out, match, length, true);
+        out += length;
+    }
+
+    *dest_pos = (uint32_t)(out - dest);
+    return 0;
+}
+int lzx_decompress_mt(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* decompressed_size, uint32_t threads) {
+    LZX_DECODER_CONTEXT* context = NULL;
+    LZX_FRAME_INFO* frames = NULL;
+    LZX_TOKEN_BUFFER buffers[2] = { 0 };
+    LZX_PARSE_JOB job = { 0 };
+    THREAD thread = { 0 };
+    uint8_t* new_dest = NULL;
+    uint32_t num_frames = 0;
+    uint32_t total_size = 0;
+    uint32_t allocated_size = 0;
+    uint32_t dest_pos = 0;
+    uint32_t frame = 0;
+    uint32_t frame_pos = 0;
+    uint32_t next_frame = 0;
+    uint32_t batch = 0;
+    uint32_t i;
+    int result = 0;
+
+    if (threads == 0) {
+        threads = thread_get_cpu_count();
+    }
+
+    result = scan_frames(src, src_size, &num_frames, &total_size);
+    if (result != 0) {
+        return result;
+    }
+
+    // the pipeline uses two threads; small inputs are not worth the hand off.
+    if (threads < 2 || num_frames < MT_MIN_FRAMES) {
+        return lzx_decompress(src, src_size, dest, dest_size, decompressed_size);
+    }
+
+    if (dest_size != NULL) {
+        allocated_size = *dest_size;
+    }
+
+    if (*dest == NULL) {
+        allocated_size = 0;
+    }
+
+    // the replay copies matches past the end of the stream into the slack.
+    if (allocated_size < lzx_decompress_bound(total_size)) {
+        new_dest = (uint8_t*)realloc(*dest, lzx_decompress_bound(total_size));
+        if (new_dest == NULL) {
+            return LZX_ERROR_OUT_OF_MEMORY;
+        }
+        *dest = new_dest;
+        allocated_size = lzx_decompress_bound(total_size);
+    }
+
+    if (dest_size != NULL) {
+        *dest_size = allocated_size;
+    }
+
+    context = lzx_create_decompression();
+    frames = (LZX_FRAME_INFO*)malloc(sizeof(LZX_FRAME_INFO) * num_frames);
+    if (context == NULL || frames == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    // each match is at least LZX_MIN_MATCH bytes; one more token per frame for the trailing literals.
+    for (i = 0; i < 2; i++) {
+        buffers[i].tokens = (LZX_TOKEN*)malloc(sizeof(LZX_TOKEN) * MT_FRAMES_PER_BATCH * (LZX_CHUNK_SIZE / LZX_MIN_MATCH + 1));
+        buffers[i].literals = (uint8_t*)malloc(MT_FRAMES_PER_BATCH * LZX_CHUNK_SIZE);
+        if (buffers[i].tokens == NULL || buffers[i].literals == NULL) {
+            result = LZX_ERROR_OUT_OF_MEMORY;
+            goto Cleanup;
+        }
+    }
+
+    job.context = context;
+    job.src = src;
+    job.frames = frames;
+
+    // parse the first batch, then parse each batch while the one before it is replayed.
+    job.first_frame = 0;
+    job.num_frames = min(MT_FRAMES_PER_BATCH, num_frames);
+    job.buffer = &buffers[0];
+    parse_frames(&job);
+    result = job.result;
+    next_frame = job.num_frames;
+
+    while (result == 0) {
+        const LZX_TOKEN_BUFFER* replay = job.buffer;
+        const uint32_t replay_end = job.first_frame + job.num_frames;
+        bool parsing = false;
+
+        if (next_frame < num_frames) {
+            job.first_frame = next_frame;
+            job.num_frames = min(MT_FRAMES_PER_BATCH, num_frames - next_frame);
+            job.buffer = &buffers[++batch & 1];
+            next_frame += job.num_frames;
+
+            if (thread_start(&thread, parse_frames, &job) != 0) {
+                result = LZX_ERROR_FAILED;
+                break;
+            }
+            parsing = true;
+        }
+
+        // a match at the end of the last frame may run into the slack.
+        result = replay_tokens(replay, *dest, &dest_pos, allocated_size);
+        if (result == 0) {
+            translate_frames(frames, &frame, &frame_pos, replay_end, *dest, (dest_pos > LZX_WINDOW_SIZE) ? dest_pos - LZX_WINDOW_SIZE : 0);
+        }
+
+        if (!parsing)
+            break;
+
+        thread_join(&thread);
+        if (result == 0)
+            result = job.result;
+    }
+
+    if (result != 0) {
+        goto Cleanup;
+    }
+
+    translate_frames(frames, &frame, &frame_pos, num_frames, *dest, total_size);
+
+    if (decompressed_size != NULL) {
+        *decompressed_size = total_size;
+    }
+
+Cleanup:
+
+    if (context != NULL) {
+        lzx_destroy_decompression(context);
+        context = NULL;
+    }
+
+    if (frames != NULL) {
+        free(frames);
+        frames = NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (buffers[i].tokens != NULL) {
+            free(buffers[i].tokens);
+            buffers[i].tokens = NULL;
+        }
+
+        if (buffers[i].literals != NULL) {
+            free(buffers[i].literals);
+            buffers[i].literals = NULL;
+        }
+    }
+
+    // the pipeline is stricter than the decoder it mirrors; never fail what the single thread decoder takes.
+    if (result != 0 && result != LZX_ERROR_OUT_OF_MEMORY) {
+        result = lzx_decompress(src, src_size, dest, dest_size, decompressed_size);
+    }
+
+    return result;
+}
+
+int lzx_decompress_range(const uint8_t* src, const uint32_t src_size, const uint32_t offset, const uint32_t size, uint8_t* dest) {
+    LZX_DECODER_CONTEXT* context = NULL;
+    const uint8_t* src_ptr = NULL;
+    LZX_BLOCK* block = NULL;
+    uint8_t* output = NULL;
+    uint8_t* frame_dest = NULL;
+    uint32_t num_frames = 0;
+    uint32_t total_size = 0;
+    uint32_t bytes_decompressed = 0;
+    uint32_t dest_pos = 0;
+    uint32_t copy_start = 0;
+    uint32_t copy_end = 0;
+    uint32_t i;
+    int result = 0;
+
+    result = scan_frames(src, src_size, &num_frames, &total_size);
+    if (result != 0) {
+        return result;
+    }
+
+    if (offset > total_size || size > total_size - offset) {
+        return LZX_ERROR_BUFFER_OVERFLOW;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    context = lzx_create_decompression();
+    output = (uint8_t*)malloc(LZX_CHUNK_SIZE);
+    if (context == NULL || output == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    // every frame up to the range is decoded in the circular window for its history.
+    src_ptr = src;
+    for (i = 0; i < num_frames && dest_pos < offset + size; i++) {
+        block = (LZX_BLOCK*)src_ptr;
+        src_ptr += sizeof(LZX_BLOCK);
+
+        // a frame inside the range is decoded straight into it.
+        copy_start = max(offset, dest_pos);
+        copy_end = min(offset + size, dest_pos + block->uncompressed_size);
+        if (copy_start == dest_pos && copy_end == dest_pos + block->uncompressed_size)
+            frame_dest = dest + (dest_pos - offset);
+        else
+            frame_dest = output;
+
+        bytes_decompressed = block->uncompressed_size;
+        result = decode_block(context, src_ptr, block->compressed_size, frame_dest, &bytes_decompressed, NULL, NULL);
+        if (result != 0) {
+            goto Cleanup;
+        }
+
+        if (bytes_decompressed != block->uncompressed_size) {
+            result = LZX_ERROR_INVALID_DATA;
+            goto Cleanup;
+        }
+
+        if (frame_dest == output && copy_start < copy_end) {
+            memcpy(dest + (copy_start - offset), output + (copy_start - dest_pos), copy_end - copy_start);
+        }
+
+        src_ptr += block->compressed_size;
+        dest_pos += bytes_decompressed;
+    }
+
+Cleanup:
+
+    if (context != NULL) {
+        lzx_destroy_decompression(context);
+        context = NULL;
+    }
+
+    if (output != NULL) {
+        free(output);
+        output = NULL;
+    }
+
+    return result;
+}
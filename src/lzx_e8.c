@@ -0,0 +1,211 @@
+// lzx_e8.c: e8 call translation for the lzx encoder and decoder
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+// std incl
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LZX_E8_X86
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// user incl
+#include "lzx_e8.h"
+#include "lzx_match.h"
+
+#ifdef MEM_TRACKING
+#include "mem_tracking.h"
+#endif
+
+#if defined(LZX_E8_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// the last 10 bytes of a frame are never translated; a call there would read past the frame.
+#define E8_TAIL_SIZE 10
+
+typedef void (*E8_TRANSLATE_PROC)(uint8_t* mem, uint32_t limit, uint32_t instr_pos, uint32_t file_size, bool decode);
+
+static E8_TRANSLATE_PROC e8_translate_proc = NULL;
+
+static inline int ctz32(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline void translate_operand(uint8_t* p, uint32_t instr_pos, uint32_t file_size, bool decode) {
+    // p: the operand following the e8 byte at instr_pos.
+
+    uint32_t value = ((uint32_t)p[0]) | (((uint32_t)p[1]) << 8) | (((uint32_t)p[2]) << 16) | (((uint32_t)p[3]) << 24);
+
+    if (decode) {
+        // absolute -> relative
+        if (value < file_size) {
+            value = value - instr_pos;
+        }
+        else if ((0u - value) <= instr_pos) {
+            value = value + file_size;
+        }
+        else {
+            return;
+        }
+    }
+    else {
+        // relative -> absolute
+        int32_t absolute = (int32_t)(instr_pos + value);
+        if (absolute < 0 || (uint32_t)absolute >= file_size + instr_pos)
+            return;
+        if ((uint32_t)absolute >= file_size)
+            value = value - file_size;
+        else
+            value = (uint32_t)absolute;
+    }
+
+    p[0] = (uint8_t)(value & 255);
+    p[1] = (uint8_t)((value >> 8) & 255);
+    p[2] = (uint8_t)((value >> 16) & 255);
+    p[3] = (uint8_t)((value >> 24) & 255);
+}
+
+static void e8_translate_byte(uint8_t* mem, uint32_t limit, uint32_t instr_pos, uint32_t file_size, bool decode) {
+    uint32_t i = 0;
+
+    while (i < limit) {
+        if (mem[i] != 0xE8) {
+            i++;
+            continue;
+        }
+        translate_operand(&mem[i + 1], instr_pos + i, file_size, decode);
+        i += 5;
+    }
+}
+
+#ifdef LZX_E8_X86
+
+// the vector kernels take every e8 out of one compare mask before loading the next vector.
+// an e8 and its operand are 5 bytes, so the 4 mask bits after each e8 are dropped; the operand
+// is rewritten in place but the mask was taken before, so it is never rescanned.
+
+TARGET_SSE2 static void e8_translate_sse2(uint8_t* mem, uint32_t limit, uint32_t instr_pos, uint32_t file_size, bool decode) {
+    const __m128i e8 = _mm_set1_epi8((char)0xE8);
+    uint32_t i = 0;
+    uint32_t mask;
+    int j;
+
+    while (i + 16 <= limit) {
+        mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mem + i)), e8));
+        if (mask == 0) {
+            i += 16;
+            continue;
+        }
+
+        for (;;) {
+            j = ctz32(mask);
+            translate_operand(&mem[i + j + 1], instr_pos + i + j, file_size, decode);
+            if (j + 5 >= 16) {
+                i += j + 5;
+                break;
+            }
+            mask &= 0xFFFFFFFF << (j + 5);
+            if (mask == 0) {
+                i += 16;
+                break;
+            }
+        }
+    }
+
+    e8_translate_byte(mem + i, (i < limit) ? limit - i : 0, instr_pos + i, file_size, decode);
+}
+
+TARGET_AVX2 static void e8_translate_avx2(uint8_t* mem, uint32_t limit, uint32_t instr_pos, uint32_t file_size, bool decode) {
+    const __m256i e8 = _mm256_set1_epi8((char)0xE8);
+    uint32_t i = 0;
+    uint32_t mask;
+    int j;
+
+    while (i + 32 <= limit) {
+        mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(mem + i)), e8));
+        if (mask == 0) {
+            i += 32;
+            continue;
+        }
+
+        for (;;) {
+            j = ctz32(mask);
+            translate_operand(&mem[i + j + 1], instr_pos + i + j, file_size, decode);
+            if (j + 5 >= 32) {
+                i += j + 5;
+                break;
+            }
+            mask &= 0xFFFFFFFF << (j + 5);
+            if (mask == 0) {
+                i += 32;
+                break;
+            }
+        }
+    }
+
+    e8_translate_sse2(mem + i, (i < limit) ? limit - i : 0, instr_pos + i, file_size, decode);
+}
+
+#endif // LZX_E8_X86
+
+static void e8_translate(uint8_t* mem, uint32_t bytes, uint32_t instr_pos, uint32_t file_size, bool decode) {
+    E8_TRANSLATE_PROC proc = e8_translate_proc;
+
+    if (bytes <= E8_TAIL_SIZE)
+        return;
+
+    if (proc == NULL) {
+        proc = e8_translate_byte;
+#ifdef LZX_E8_X86
+        if (lzx_cpu_has_avx2())
+            proc = e8_translate_avx2;
+        else if (lzx_cpu_has_sse2())
+            proc = e8_translate_sse2;
+#endif
+        e8_translate_proc = proc;
+    }
+
+    proc(mem, bytes - E8_TAIL_SIZE, instr_pos, file_size, decode);
+}
+
+void lzx_e8_encode(uint8_t* mem, uint32_t bytes, uint32_t instr_pos, uint32_t file_size) {
+    e8_translate(mem, bytes, instr_pos, file_size, false);
+}
+
+void lzx_e8_decode(uint8_t* mem, uint32_t bytes, uint32_t instr_pos, uint32_t file_size) {
+    e8_translate(mem, bytes, instr_pos, file_size, true);
+}
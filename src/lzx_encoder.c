@@ -9,6 +9,11 @@
 
 // user incl
 #include "lzx.h"
+#include "lzx_e8.h"
+#include "lzx_match.h"
+#include "thread.h"
+#include "file.h"
+#include "sha1.h"
 
 #ifdef MEM_TRACKING
 #include "mem_tracking.h"
@@ -37,12 +42,21 @@
 #define TREE_CREATE_INTERVAL 4096
 #define STEP_SIZE 64
 #define RESOLUTION 1024
-#define THRESHOLD 1400
-#define EARLY_BREAK_THRESHOLD 1700
-#define MAX_BLOCK_SPLITS 4
 #define FAST_DECISION_THRESHOLD 50
+#define SPLIT_THRESHOLD 1400
+#define EARLY_BREAK_THRESHOLD 1700
+#define SPLIT_TREE_COST 2
+#define SPLIT_BLOCK_COST 500
+#define SPLIT_EXTRA_GAIN_SHIFT 6
+#define SPLIT_OPTIMAL_GAIN_SHIFT 8
 #define MPSLOT3_CUTOFF 16
 
+#define NUM_PRETREE_ELEMENTS 20
+#define MT_MIN_SEGMENT_SIZE (256*1024)
+#define CHECKPOINT_MAGIC 0x43585A4C // LZXC
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_SEGMENT_SIZE (128*1024)
+
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 #define log2(x) ((x) < 256 ? log2_table[(x)] : 8 + log2_table[(x) >> 8])
 
@@ -58,6 +72,9 @@
 #define TREE_ENC_REP_SAME_EXTRA_BITS 1
 
 #define NUM_SEARCH_TREES 65536
+#define HASH_CHAIN_DEPTH 32
+#define ULTRA_MAX_PASSES 6
+#define HASH3(mem, pos) ((uint16_t)((((uint32_t)(mem)[(pos)] | ((uint32_t)(mem)[(pos) + 1] << 8) | ((uint32_t)(mem)[(pos) + 2] << 16)) * 2654435761U) >> 16))
 
 #define MP_SLOT(matchpos) \
     ((matchpos) < 1024 ? (uint8_t) context->slot_table[(matchpos)] : ((matchpos) < 524288L ? (uint8_t)18 + (uint8_t)context->slot_table[(matchpos) >> 9] : ((uint8_t)34 + (uint8_t)(matchpos >> 17))))
@@ -84,22 +101,31 @@ if (context->literals >= context->next_tree_create) { \
     context->next_tree_create += TREE_CREATE_INTERVAL; \
 }
 
-#define OUTPUT_BITS(N, X) { \
-   context->bitbuf |= (((uint32_t) (X)) << (context->bitcount-(N))); \
+// the bit buffer is 64 bits; bitcount is the number of free bits. bits are added from the top
+// and written out 32 at a time as two little endian 16 bit words. up to 33 bits can be added
+// between flushes.
+#define PUT_BITS(N, X) { \
+   context->bitbuf |= (((uint64_t) (X)) << (context->bitcount-(N))); \
    context->bitcount -= (N); \
-   while (context->bitcount <= 16) { \
+}
+
+#define FLUSH_BITS() { \
+   if (context->bitcount <= 32) { \
       if (context->output_buffer_curpos >= context->output_buffer_end) { \
           context->output_overflow = true; \
           context->output_buffer_curpos = context->output_buffer_start; \
       } \
-      *context->output_buffer_curpos++ = (uint8_t) ((context->bitbuf >> 16) & 255); \
-      *context->output_buffer_curpos++ = (uint8_t) (context->bitbuf >> 24); \
-      context->bitbuf <<= 16; \
-      context->bitcount += 16; \
+      context->output_buffer_curpos[0] = (uint8_t) ((context->bitbuf >> 48) & 255); \
+      context->output_buffer_curpos[1] = (uint8_t) (context->bitbuf >> 56); \
+      context->output_buffer_curpos[2] = (uint8_t) ((context->bitbuf >> 32) & 255); \
+      context->output_buffer_curpos[3] = (uint8_t) ((context->bitbuf >> 40) & 255); \
+      context->output_buffer_curpos += 4; \
+      context->bitbuf <<= 32; \
+      context->bitcount += 32; \
    } \
 }
 
-#define OUT_CHAR_BITS OUTPUT_BITS(context->main_tree_len[context->lit_data[l]], context->main_tree_code[context->lit_data[l]]);
+#define OUT_CHAR_BITS { PUT_BITS(context->main_tree_len[context->lit_data[l]], context->main_tree_code[context->lit_data[l]]); FLUSH_BITS(); }
 
 static const long square_table[17] = {
     0,1,4,9,16,25,36,49,64,81,100,121,144,169,196,225,256
@@ -138,6 +164,24 @@ static const uint8_t log2_table[256] = {
     8,8,8,8,8,8,8,8,
     8,8,8,8,8,8,8,8
 };
+static const uint8_t log2_frac_table[256] = {
+    0,1,3,4,6,7,9,10,11,13,14,16,17,18,20,21,
+    22,24,25,26,28,29,30,32,33,34,36,37,38,40,41,42,
+    44,45,46,47,49,50,51,52,54,55,56,57,59,60,61,62,
+    63,65,66,67,68,69,71,72,73,74,75,77,78,79,80,81,
+    82,84,85,86,87,88,89,90,92,93,94,95,96,97,98,99,
+    100,102,103,104,105,106,107,108,109,110,111,112,113,114,116,117,
+    118,119,120,121,122,123,124,125,126,127,128,129,130,131,132,133,
+    134,135,136,137,138,139,140,141,142,143,144,145,146,147,148,149,
+    150,151,152,153,154,155,155,156,157,158,159,160,161,162,163,164,
+    165,166,167,168,169,169,170,171,172,173,174,175,176,177,178,178,
+    179,180,181,182,183,184,185,185,186,187,188,189,190,191,192,192,
+    193,194,195,196,197,198,198,199,200,201,202,203,203,204,205,206,
+    207,208,208,209,210,211,212,212,213,214,215,216,216,217,218,219,
+    220,220,221,222,223,224,224,225,226,227,228,228,229,230,231,231,
+    232,233,234,234,235,236,237,238,238,239,240,241,241,242,243,244,
+    244,245,246,247,247,248,249,249,250,251,252,252,253,254,255,255
+};
 static const uint32_t slot_mask[] = {
          0,      0,      0,      0,     1,       1,      3,      3,
          7,      7,     15,     15,    31,      31,     63,     63,
@@ -157,7 +201,70 @@ static const uint8_t lzx_extra_bits[] = {
     17,17,17
 };
 
+typedef struct {
+    const uint8_t* src;
+    const LZX_COMPRESSION_PARAMS* params;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t* output;
+    uint32_t output_capacity;
+    uint32_t output_size;
+    bool pad;
+    int result;
+} LZX_SEGMENT;
+
+typedef struct {
+    const uint8_t* src;
+    uint32_t src_size;
+    LZX_COMPRESSION_PARAMS params;
+    uint8_t* output;
+    uint32_t output_size;
+    int result;
+} LZX_FIT_CANDIDATE;
+
+// incremental compression checkpoint; the header is followed by a record per segment,
+// then the output of every segment in order.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t src_size;
+    uint32_t segment_size;
+    uint32_t segment_count;
+    uint32_t match_finder;
+    uint32_t level;
+    uint32_t max_block_splits;
+    uint32_t split_min_gain;
+    uint32_t e8_translation;
+} LZX_CHECKPOINT_HEADER;
+
+typedef struct {
+    uint8_t digest[SHA1_DIGEST_LEN];
+    uint32_t output_size;
+    uint32_t pad;
+} LZX_CHECKPOINT_SEGMENT;
+
+typedef struct {
+    int max_block_splits;
+    int split_min_gain;
+    bool e8_translation;
+    int level; // 0 = keep the base level
+} LZX_FIT_VARIANT;
+
+// parameter variants tried by lzx_compress_fit() after the base parameters; cheapest first.
+static const LZX_FIT_VARIANT fit_variants[] = {
+    { LZX_DEFAULT_MAX_BLOCK_SPLITS, LZX_DEFAULT_SPLIT_MIN_GAIN, false, 0 },
+    { 16, LZX_DEFAULT_SPLIT_MIN_GAIN, true, 0 },
+    { 16, LZX_DEFAULT_SPLIT_MIN_GAIN, false, 0 },
+    { 2, 256, true, 0 },
+    { 0, LZX_DEFAULT_SPLIT_MIN_GAIN, true, 0 },
+    { LZX_DEFAULT_MAX_BLOCK_SPLITS, LZX_DEFAULT_SPLIT_MIN_GAIN, true, LZX_LEVEL_ULTRA },
+    { 16, LZX_DEFAULT_SPLIT_MIN_GAIN, true, LZX_LEVEL_ULTRA },
+    { 16, LZX_DEFAULT_SPLIT_MIN_GAIN, false, LZX_LEVEL_ULTRA },
+};
+
 static void encode_flush(ENCODER_CONTEXT* context);
+static void encode_segment_start(ENCODER_CONTEXT* context);
+static void prime_compression(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t offset, uint32_t size);
 
 static bool init_compressed_output_buffer(ENCODER_CONTEXT* context) {
     context->output_buffer_start = (uint8_t*)malloc(LZX_OUTPUT_SIZE);
@@ -209,62 +316,34 @@ static void create_slot_lookup_table(ENCODER_CONTEXT* context) {
 }
 
 static void translate_e8(ENCODER_CONTEXT* context, uint8_t* mem, long bytes) {
-    long offset;
-    long absolute;
-    uint32_t end_instr_pos;
-    uint8_t temp[6];
-    uint8_t* mem_backup;
-
-    if (bytes <= 6) {
-        context->instr_pos += bytes;
+    if (bytes <= 0)
         return;
-    }
-
-    mem_backup = mem;
-
-    memcpy(temp, &mem[bytes - 6], 6);
-    memset(&mem[bytes - 6], 0xE8, 6);
-
-    end_instr_pos = context->instr_pos + bytes - 10;
-
-    while (1) {
-        while (*mem++ != 0xE8)
-            context->instr_pos++;
-
-        if (context->instr_pos >= end_instr_pos)
-            break;
 
-        offset = *(long*)mem;
-        absolute = context->instr_pos + offset;
-
-        if (absolute >= 0) {
-            if ((uint32_t)absolute < context->file_size_for_translation + context->instr_pos) {
-                if ((uint32_t)absolute >= context->file_size_for_translation)
-                    absolute = offset - context->file_size_for_translation;
-                *(uint32_t*)mem = (uint32_t)absolute;
-            }
-        }
-
-        mem += 4;
-        context->instr_pos += 5;
-    }
-
-    memcpy(&mem_backup[bytes - 6], temp, 6);
-
-    context->instr_pos = end_instr_pos + 10;
+    lzx_e8_encode(mem, (uint32_t)bytes, context->instr_pos, context->file_size_for_translation);
+    context->instr_pos += bytes;
 }
 static void output_bits(ENCODER_CONTEXT* context, int n, uint32_t x) {
-    context->bitbuf |= (x << (context->bitcount - n));
-    context->bitcount -= (char)n;
+    PUT_BITS(n, x);
+    FLUSH_BITS();
+}
+static void align_output_bits(ENCODER_CONTEXT* context, bool pad_aligned) {
+    // pad the bits to a 16 bit boundary and write out every word. pad_aligned pads a whole
+    // word when the bits are already aligned, as an uncompressed block header requires.
 
-    while (context->bitcount <= 16) {
+    int pad = 16 - ((64 - context->bitcount) & 15);
+    if (pad == 16 && !pad_aligned)
+        pad = 0;
+
+    context->bitcount -= (char)pad;
+
+    while (context->bitcount < 64) {
         if (context->output_buffer_curpos >= context->output_buffer_end) {
             context->output_overflow = true;
             context->output_buffer_curpos = context->output_buffer_start;
         }
 
-        *context->output_buffer_curpos++ = (uint8_t)((context->bitbuf >> 16) & 255);
-        *context->output_buffer_curpos++ = (uint8_t)(context->bitbuf >> 24);
+        *context->output_buffer_curpos++ = (uint8_t)((context->bitbuf >> 48) & 255);
+        *context->output_buffer_curpos++ = (uint8_t)(context->bitbuf >> 56);
 
         context->bitbuf <<= 16;
         context->bitcount += 16;
@@ -298,8 +377,10 @@ static void init_compression_memory(ENCODER_CONTEXT* context) {
 
     memset(context->tree_root, 0, NUM_SEARCH_TREES * sizeof(context->tree_root[0]));
     context->mem_window = context->real_mem_window - context->window_size;
-    context->left = context->real_left - context->window_size;
-    context->right = context->real_right - context->window_size;
+    if (context->real_left != NULL)
+        context->left = context->real_left - context->window_size;
+    if (context->real_right != NULL)
+        context->right = context->real_right - context->window_size;
     context->bufpos = context->window_size;
     context->last_matchpos_offset[0] = 1;
     context->last_matchpos_offset[1] = 1;
@@ -310,7 +391,7 @@ static void init_compression_memory(ENCODER_CONTEXT* context) {
     context->first_block = true;
     context->need_to_recalc_stats = true;
     context->bufpos_last_output_block = context->bufpos;
-    context->bitcount = 32;
+    context->bitcount = 64;
     context->bitbuf = 0;
     context->output_overflow = false;
 
@@ -395,18 +476,43 @@ static void free_compress_memory(ENCODER_CONTEXT* context) {
 		free(context->input_buffer);
 		context->input_buffer = NULL;
 	}
+
+    if (context->pass_costs != NULL) {
+        free(context->pass_costs);
+        context->pass_costs = NULL;
+    }
+
+    if (context->pass_record != NULL) {
+        free(context->pass_record);
+        context->pass_record = NULL;
+    }
+
+    if (context->split_hist != NULL) {
+        free(context->split_hist);
+        context->split_hist = NULL;
+    }
 }
 static bool alloc_compress_memory(ENCODER_CONTEXT* context) {
 
     context->tree_root = NULL;
     context->real_left = NULL;
     context->real_right = NULL;
+    context->left = NULL;
+    context->right = NULL;
     context->mem_window = NULL;
     context->decision_node = NULL;
     context->lit_data = NULL;
     context->dist_data = NULL;
     context->item_type = NULL;
     context->output_buffer_start = NULL;
+    context->pass_costs = NULL;
+    context->pass_cost_count = 0;
+    context->pass_cost_capacity = 0;
+    context->pass_record = NULL;
+    context->pass_record_count = 0;
+    context->pass_record_capacity = 0;
+    context->pass_recording = false;
+    context->split_hist = NULL;
     context->num_position_slots = 4;
     uint32_t pos_start = 4;
     while (1) {
@@ -424,16 +530,22 @@ static bool alloc_compress_memory(ENCODER_CONTEXT* context) {
         return false;
     }
 
-    context->real_left = (uint32_t*)malloc(sizeof(uint32_t) * MEM_WINDOW_ALLOC_SIZE);
-    if (context->real_left == NULL) {
-        free_compress_memory(context);
-        return false;
+    // the binary tree uses left and right; the hash chain only uses left as the chain.
+    // the hash table only uses tree_root.
+    if (context->match_finder != LZX_MATCH_FINDER_HASH_TABLE) {
+        context->real_left = (uint32_t*)malloc(sizeof(uint32_t) * MEM_WINDOW_ALLOC_SIZE);
+        if (context->real_left == NULL) {
+            free_compress_memory(context);
+            return false;
+        }
     }
 
-    context->real_right = (uint32_t*)malloc(sizeof(uint32_t) * MEM_WINDOW_ALLOC_SIZE);
-    if (context->real_right == NULL) {
-        free_compress_memory(context);
-        return false;
+    if (context->match_finder == LZX_MATCH_FINDER_BINARY_TREE) {
+        context->real_right = (uint32_t*)malloc(sizeof(uint32_t) * MEM_WINDOW_ALLOC_SIZE);
+        if (context->real_right == NULL) {
+            free_compress_memory(context);
+            return false;
+        }
     }
 
     context->real_mem_window = (uint8_t*)malloc(MEM_WINDOW_ALLOC_SIZE);
@@ -483,6 +595,13 @@ static bool alloc_compress_memory(ENCODER_CONTEXT* context) {
 		return false;
 	}
 
+    // prefix histograms of the main tree symbols, one row per split step.
+    context->split_hist = (uint16_t*)malloc(sizeof(uint16_t) * (MAX_LITERAL_ITEMS / STEP_SIZE + 1) * LZX_MAX_MAIN_TREE_ELEMENTS);
+    if (context->split_hist == NULL) {
+        free_compress_memory(context);
+        return false;
+    }
+
     return true;
 }
 
@@ -505,178 +624,310 @@ static long read_input(ENCODER_CONTEXT* context, uint32_t buf_pos, long size) {
 
     return bytes_read;
 }
-static uint32_t return_difference(ENCODER_CONTEXT* context, uint32_t item_start1, uint32_t item_start2, uint32_t dist_at_1, uint32_t dist_at_2, uint32_t size) {
-    uint16_t freq1[800];
-    uint16_t freq2[800];
-    uint32_t i;
-    uint32_t cum_diff;
-    int element;
+static uint32_t log2_fixed(uint32_t x) {
+    // log2(x) in 1/256 bits. x > 0.
+    uint32_t e = 0;
+    uint32_t m;
 
-    if (LZX_MAIN_TREE_ELEMENTS(context->num_position_slots) >= (sizeof(freq1) / sizeof(freq1[0])))
-        return 0;
+    if (x >= 65536)
+        e += 16;
+    if ((x >> e) >= 256)
+        e += 8;
+    e += log2_table[x >> e] - 1;
 
-    memset(freq1, 0, sizeof(freq1[0]) * LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
-    memset(freq2, 0, sizeof(freq2[0]) * LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
+    m = (e >= 8) ? (x >> (e - 8)) & 255 : (x << (8 - e)) & 255;
 
-    for (i = 0; i < size; i++) {
-        if (!IS_MATCH(item_start1)) {
-            element = context->lit_data[item_start1];
-        }
-        else {
-            if (context->lit_data[item_start1] < LZX_NUM_PRIMARY_LEN)
-                element = NUM_CHARS + (MP_SLOT(context->dist_data[dist_at_1]) << NL_SHIFT) + context->lit_data[item_start1];
-            else
-                element = (NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (MP_SLOT(context->dist_data[dist_at_1]) << NL_SHIFT);
+    return (e << 8) + log2_frac_table[m];
+}
 
-            dist_at_1++;
-        }
+static uint32_t return_difference(ENCODER_CONTEXT* context, uint32_t step1, uint32_t step2) {
+    // how much the main tree statistics of the RESOLUTION items from step1 and from step2 differ.
+    const uint32_t elements = LZX_MAIN_TREE_ELEMENTS(context->num_position_slots);
+    const uint32_t window = RESOLUTION / STEP_SIZE;
+    const uint16_t* from1 = &context->split_hist[step1 * elements];
+    const uint16_t* to1 = &context->split_hist[(step1 + window) * elements];
+    const uint16_t* from2 = &context->split_hist[step2 * elements];
+    const uint16_t* to2 = &context->split_hist[(step2 + window) * elements];
+    uint32_t cum_diff = 0;
+    uint32_t freq1;
+    uint32_t freq2;
+    uint32_t i;
 
-        item_start1++;
-        freq1[element]++;
+    for (i = 0; i < elements; i++) {
+        freq1 = (uint16_t)(to1[i] - from1[i]);
+        freq2 = (uint16_t)(to2[i] - from2[i]);
+        cum_diff += abs((int)(square_table[log2(freq1)] - square_table[log2(freq2)]));
+    }
 
-        if (!IS_MATCH(item_start2)) {
-            element = context->lit_data[item_start2];
+    return cum_diff;
+}
+static uint32_t find_statistics_split(ENCODER_CONTEXT* context, uint32_t start_step, uint32_t end) {
+    // the first step where the statistics of the windows either side of it differ by more
+    // than SPLIT_THRESHOLD at three widths, moved to where they differ most; 0 if none
+    // differ by EARLY_BREAK_THRESHOLD.
+    const uint32_t window = RESOLUTION / STEP_SIZE;
+    uint32_t max_diff;
+    uint32_t diff;
+    uint32_t split;
+    uint32_t i;
+    uint32_t j;
+
+    for (i = start_step + 2 * window; (i + 4 * window) * STEP_SIZE < end; i += window) {
+        if (return_difference(context, i, i + window) <= SPLIT_THRESHOLD
+            || return_difference(context, i - window, i + 2 * window) <= SPLIT_THRESHOLD
+            || return_difference(context, i - 2 * window, i + 3 * window) <= SPLIT_THRESHOLD)
+            continue;
+
+        max_diff = 0;
+        split = 0;
+        for (j = i + window / 2; j < i + (5 * window) / 2; j++) {
+            diff = return_difference(context, j - window, j);
+            if (diff > max_diff) {
+                max_diff = diff;
+                split = j;
+            }
         }
-        else {
-            if (context->lit_data[item_start2] < LZX_NUM_PRIMARY_LEN)
-                element = NUM_CHARS + (MP_SLOT(context->dist_data[dist_at_2]) << NL_SHIFT) + context->lit_data[item_start2];
-            else
-                element = (NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (MP_SLOT(context->dist_data[dist_at_2]) << NL_SHIFT);
 
-            dist_at_2++;
+        if (max_diff >= EARLY_BREAK_THRESHOLD && (split - start_step) * STEP_SIZE >= MIN_LITERALS_IN_BLOCK)
+            return split;
+    }
+
+    return 0;
+}
+static uint64_t estimate_split_cost(ENCODER_CONTEXT* context, uint32_t from_step, uint32_t to_step) {
+    // estimated size in 1/256 bits of the items between two steps coded as one block;
+    // the entropy of the main tree symbols plus the cost of sending the tree.
+    const uint32_t elements = LZX_MAIN_TREE_ELEMENTS(context->num_position_slots);
+    const uint16_t* from = &context->split_hist[from_step * elements];
+    const uint16_t* to = &context->split_hist[to_step * elements];
+    uint64_t sum = 0;
+    uint32_t total = 0;
+    uint32_t used = 0;
+    uint32_t freq;
+    uint32_t i;
+
+    for (i = 0; i < elements; i++) {
+        // the counts wrap at 16 bits, but no window holds 65536 of one symbol.
+        freq = (uint16_t)(to[i] - from[i]);
+        if (freq != 0) {
+            sum += (uint64_t)freq * log2_fixed(freq);
+            total += freq;
+            used++;
         }
+    }
+
+    if (total == 0)
+        return 0;
 
-        item_start2++;
-        freq2[element]++;
+    return (uint64_t)total * log2_fixed(total) - sum + ((uint64_t)(used * SPLIT_TREE_COST + SPLIT_BLOCK_COST) << 8);
+}
+static uint32_t find_split(ENCODER_CONTEXT* context, uint32_t start_step, uint32_t end_step, uint32_t first_step, uint32_t last_step, uint64_t min_gain) {
+    // the step between first_step and last_step that saves the most over coding
+    // start_step..end_step as one block, or 0 if no step saves more than min_gain.
+    const uint32_t coarse = RESOLUTION / STEP_SIZE;
+    uint64_t whole_cost;
+    uint64_t best_cost;
+    uint64_t cost;
+    uint32_t best_step = 0;
+    uint32_t from;
+    uint32_t step;
+
+    whole_cost = estimate_split_cost(context, start_step, end_step);
+    best_cost = whole_cost;
+
+    // a coarse pass every RESOLUTION items, then every step around the best split.
+    for (step = first_step; step <= last_step; step += coarse) {
+        cost = estimate_split_cost(context, start_step, step) + estimate_split_cost(context, step, end_step);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_step = step;
+        }
     }
 
-    cum_diff = 0;
+    if (best_step == 0)
+        return 0;
 
-    for (i = 0; i < (uint32_t)LZX_MAIN_TREE_ELEMENTS(context->num_position_slots); i++) {
-        uint32_t log2a = (uint32_t)log2(freq1[i]);
-        uint32_t log2b = (uint32_t)log2(freq2[i]);
-        uint32_t diff = square_table[log2a] - square_table[log2b];
-        cum_diff += abs((long)diff);
+    from = (best_step > first_step + coarse) ? best_step - coarse + 1 : first_step;
+    for (step = from; step <= last_step && step < from + 2 * coarse; step++) {
+        cost = estimate_split_cost(context, start_step, step) + estimate_split_cost(context, step, end_step);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_step = step;
+        }
     }
 
-    return cum_diff;
+    if (whole_cost - best_cost <= min_gain)
+        return 0;
+
+    return best_step;
 }
 static bool split_block(ENCODER_CONTEXT* context, uint32_t start, uint32_t end, uint32_t distance_to_end_at, uint32_t* split_at_literal, uint32_t* split_at_distance) {
-    uint32_t i, j;
+    // split the block where coding the two halves with their own trees is estimated to be
+    // smallest. the main tree statistics are kept as prefix sums every STEP_SIZE items, so
+    // the statistics of any window are one subtraction.
+
+    const uint32_t elements = LZX_MAIN_TREE_ELEMENTS(context->num_position_slots);
+    uint16_t num_dist_at_step[(MAX_LITERAL_ITEMS / STEP_SIZE) + 1];
+    uint16_t* row = NULL;
+    uint64_t whole_cost;
+    uint64_t min_gain;
+    uint32_t gain_shift;
+    uint32_t steps;
+    uint32_t start_step;
+    uint32_t first_step;
+    uint32_t last_step;
+    uint32_t best_step = 0;
+    uint32_t step;
+    uint32_t i;
     uint32_t d = 0;
-    int nd = 0;
-    uint16_t num_dist_at_item[(MAX_LITERAL_ITEMS / STEP_SIZE) + 8] = {0};
+    int element;
 
     *split_at_literal = end;
     if (split_at_distance)
         *split_at_distance = distance_to_end_at;
     if (end - start < MIN_LITERALS_REQUIRED)
         return false;
-    if (context->num_block_splits >= MAX_BLOCK_SPLITS)
-        return false;
 
-    for (i = 0; i < (end >> 3); i++) {
-        if ((i & ((STEP_SIZE >> 3) - 1)) == 0)
-            num_dist_at_item[nd++] = (uint16_t)d;
-
-        d += context->ones[context->item_type[i]];
-    }
-
-    start = (start + (STEP_SIZE - 1)) & (~(STEP_SIZE - 1));
+    steps = end / STEP_SIZE;
+    start_step = (start + (STEP_SIZE - 1)) / STEP_SIZE;
+    first_step = (start + MIN_LITERALS_IN_BLOCK + (STEP_SIZE - 1)) / STEP_SIZE;
+    last_step = (end - MIN_LITERALS_IN_BLOCK) / STEP_SIZE;
+    if (first_step > last_step)
+        return false;
 
-    for (i = start + 2 * RESOLUTION; i < end - 4 * RESOLUTION; i += RESOLUTION) {
-        if (return_difference(context, i, i + 1 * RESOLUTION, (uint32_t)num_dist_at_item[i / STEP_SIZE], (uint32_t)num_dist_at_item[(i + 1 * RESOLUTION) / STEP_SIZE], RESOLUTION) > THRESHOLD
-            && return_difference(context, i - RESOLUTION, i + 2 * RESOLUTION, (uint32_t)num_dist_at_item[(i - RESOLUTION) / STEP_SIZE], (uint32_t)num_dist_at_item[(i + 2 * RESOLUTION) / STEP_SIZE], RESOLUTION) > THRESHOLD
-            && return_difference(context, i - 2 * RESOLUTION, i + 3 * RESOLUTION, (uint32_t)num_dist_at_item[(i - 2 * RESOLUTION) / STEP_SIZE], (uint32_t)num_dist_at_item[(i + 3 * RESOLUTION) / STEP_SIZE], RESOLUTION) > THRESHOLD) {
-            uint32_t max_diff = 0;
-            uint32_t literal_split = 0;
+    memset(context->split_hist, 0, sizeof(uint16_t) * elements);
+    num_dist_at_step[0] = 0;
 
-            for (j = i + RESOLUTION / 2; j < i + (5 * RESOLUTION) / 2; j += STEP_SIZE) {
-                uint32_t diff;
-                diff = return_difference(context, j - RESOLUTION, j, (uint32_t)num_dist_at_item[(j - RESOLUTION) / STEP_SIZE], (uint32_t)num_dist_at_item[j / STEP_SIZE], RESOLUTION);
+    for (step = 1; step <= steps; step++) {
+        row = &context->split_hist[step * elements];
+        memcpy(row, row - elements, sizeof(uint16_t) * elements);
 
-                if (diff > max_diff) {
-                    max_diff = diff;
-                    literal_split = j;
-                }
+        for (i = (step - 1) * STEP_SIZE; i < step * STEP_SIZE; i++) {
+            if (!IS_MATCH(i)) {
+                element = context->lit_data[i];
             }
-
-            if (max_diff >= EARLY_BREAK_THRESHOLD && (literal_split - start) >= MIN_LITERALS_IN_BLOCK) {
-                context->num_block_splits++;
-                *split_at_literal = literal_split;
-                if (split_at_distance)
-                    *split_at_distance = num_dist_at_item[literal_split / STEP_SIZE];
-                return true;
+            else {
+                if (context->lit_data[i] < LZX_NUM_PRIMARY_LEN)
+                    element = NUM_CHARS + (MP_SLOT(context->dist_data[d]) << NL_SHIFT) + context->lit_data[i];
+                else
+                    element = (NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (MP_SLOT(context->dist_data[d]) << NL_SHIFT);
+                d++;
             }
+            row[element]++;
         }
+
+        num_dist_at_step[step] = (uint16_t)d;
     }
 
-    return false;
-}
+    // past max_block_splits, a split has to save a fraction of the block.
+    gain_shift = (context->num_block_splits >= context->max_block_splits) ? SPLIT_EXTRA_GAIN_SHIFT : 0;
 
-static void count_len(ENCODER_CONTEXT* context, short i) {
-    if (i < context->tree_n) {
-        context->tree_len_cnt[(context->depth < 16) ? context->depth : 16]++;
-    }
-    else {
-        context->depth++;
-        count_len(context, context->tree_leftright[i * 2]);
-        count_len(context, context->tree_leftright[i * 2 + 1]);
-        context->depth--;
+    // the optimal parse loses ratio on code from the estimate's splits; split where the
+    // statistics change first, and only where the estimate saves a larger fraction after that.
+    if (context->level == LZX_LEVEL_OPTIMAL) {
+        if (context->num_block_splits < context->max_block_splits) {
+            best_step = find_statistics_split(context, start_step, end);
+            if (best_step != 0)
+                goto Split;
+        }
+        gain_shift = SPLIT_OPTIMAL_GAIN_SHIFT;
     }
-}
-static void make_len(ENCODER_CONTEXT* context, short root) {
-    short k;
-    uint16_t cum;
-    uint8_t i;
 
-    for (i = 0; i <= 16; i++)
-        context->tree_len_cnt[i] = 0;
+    min_gain = (uint64_t)context->split_min_gain << 8;
+    if (gain_shift != 0) {
+        whole_cost = estimate_split_cost(context, start_step, steps);
+        if (min_gain < (whole_cost >> gain_shift))
+            min_gain = whole_cost >> gain_shift;
+    }
 
-    count_len(context, root);
+    // split at the best point, then keep looking for a better point in the first half so
+    // the blocks are cut from the front; the rest is split again when it is output.
+    while (first_step <= last_step) {
+        step = find_split(context, start_step, steps, first_step, last_step, min_gain);
+        if (step == 0)
+            break;
+        best_step = step;
+        steps = step;
+        last_step = (steps * STEP_SIZE - MIN_LITERALS_IN_BLOCK) / STEP_SIZE;
+    }
 
-    cum = 0;
+    if (best_step == 0)
+        return false;
 
-    for (i = 16; i > 0; i--)
-        cum += (uint16_t)(context->tree_len_cnt[i] << (16 - i));
+Split:
+    context->num_block_splits++;
+    *split_at_literal = best_step * STEP_SIZE;
+    if (split_at_distance)
+        *split_at_distance = num_dist_at_step[best_step];
 
-    while (cum) {
-        context->tree_len_cnt[16]--;
+    return true;
+}
 
-        for (i = 15; i > 0; i--) {
-            if (context->tree_len_cnt[i]) {
-                context->tree_len_cnt[i]--;
-                context->tree_len_cnt[i + 1] += 2;
-                break;
+static int compare_tree_keys(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a;
+    const uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+static void make_len(ENCODER_CONTEXT* context, int n, uint8_t max_len) {
+    // package-merge. tree_keys holds the n used symbols sorted by frequency. each level's list
+    // is the symbols merged with the pairs of the level below; a symbol's length is the number
+    // of levels it is active in, counting down from the 2n-2 cheapest items of the top level.
+    uint32_t* prev = context->tree_weight[0];
+    uint32_t* cur = context->tree_weight[1];
+    uint32_t* tmp;
+    uint32_t count[LZX_MAX_TREE_LEN + 1];
+    uint32_t prev_count = 0;
+    uint32_t packages;
+    uint32_t leaf;
+    uint32_t pkg;
+    uint32_t m;
+    uint32_t i;
+    int level;
+
+    for (level = max_len - 1; level >= 0; level--) {
+        packages = prev_count >> 1;
+        leaf = 0;
+        pkg = 0;
+        m = 0;
+
+        while (leaf < (uint32_t)n || pkg < packages) {
+            if (pkg >= packages || (leaf < (uint32_t)n && (context->tree_keys[leaf] >> 16) <= prev[2 * pkg] + prev[2 * pkg + 1])) {
+                cur[m] = context->tree_keys[leaf++] >> 16;
+                context->tree_is_leaf[level][m++] = 1;
+            }
+            else {
+                cur[m] = prev[2 * pkg] + prev[2 * pkg + 1];
+                pkg++;
+                context->tree_is_leaf[level][m++] = 0;
             }
         }
 
-        cum--;
+        prev_count = m;
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
     }
 
-    for (i = 16; i > 0; i--) {
-        k = context->tree_len_cnt[i];
-
-        while (--k >= 0)
-            context->len[*context->tree_sortptr++] = (uint8_t)i;
+    m = 2 * n - 2;
+    for (level = 0; level < max_len; level++) {
+        count[level] = 0;
+        for (i = 0; i < m; i++)
+            count[level] += context->tree_is_leaf[level][i];
+        m = 2 * (m - count[level]);
     }
-}
 
-static void down_heap(ENCODER_CONTEXT* context, short i) {
-    short k = context->tree_heap[i];
-    short j;
-    while ((j = (i << 1)) <= context->tree_heapsize) {
-        if (j < context->tree_heapsize && context->tree_freq[context->tree_heap[j]] > context->tree_freq[context->tree_heap[j + 1]])
-            j++;
-
-        if (context->tree_freq[k] <= context->tree_freq[context->tree_heap[j]])
-            break;
+    for (i = 0; i <= LZX_MAX_TREE_LEN; i++)
+        context->tree_len_cnt[i] = 0;
 
-        context->tree_heap[i] = context->tree_heap[j];
-        i = j;
+    for (i = 0; i < (uint32_t)n; i++) {
+        leaf = 0;
+        for (level = 0; level < max_len; level++) {
+            if (i < count[level])
+                leaf++;
+        }
+        context->len[context->tree_keys[i] & 0xFFFF] = (uint8_t)leaf;
+        context->tree_len_cnt[leaf]++;
     }
-
-    context->tree_heap[i] = k;
 }
 static void make_code(ENCODER_CONTEXT* context, int n, char len[], uint16_t code[]) {
     int i;
@@ -688,63 +939,25 @@ static void make_code(ENCODER_CONTEXT* context, int n, char len[], uint16_t code
         code[i] = start[len[i]]++;
     }
 }
-static void make_tree2(ENCODER_CONTEXT* context, short avail, uint16_t freqparm[], uint16_t codeparm[]) {
-    short i, j, k;
-    for (i = context->tree_heapsize >> 1; i >= 1; i--)
-        down_heap(context, i);
-
-    context->tree_sortptr = codeparm;
-
-    do {
-        i = context->tree_heap[1];
-        if (i < context->tree_n)
-            *context->tree_sortptr++ = i;
-
-        context->tree_heap[1] = context->tree_heap[context->tree_heapsize--];
-        down_heap(context, 1);
-
-        j = context->tree_heap[1];
-        if (j < context->tree_n)
-            *context->tree_sortptr++ = j;
-
-        k = avail++;
-
-        freqparm[k] = freqparm[i] + freqparm[j];
-        context->tree_heap[1] = k;
-        down_heap(context, 1);
-
-        context->tree_leftright[k * 2] = i;
-        context->tree_leftright[k * 2 + 1] = j;
-
-    } while (context->tree_heapsize > 1);
-
-    context->tree_sortptr = codeparm;
-    make_len(context, k);
-}
-static void make_tree(ENCODER_CONTEXT* context, int nparm, uint16_t* freqparm, uint8_t* lenparm, uint16_t* codeparm, bool make_codes) {
-    short i, avail;
+static void make_tree(ENCODER_CONTEXT* context, int nparm, uint16_t* freqparm, uint8_t* lenparm, uint16_t* codeparm, uint8_t max_len, bool make_codes) {
+    int i, used;
 RedoTree:
-    context->tree_n = nparm;
-    context->tree_freq = freqparm;
     context->len = lenparm;
-    avail = (short)context->tree_n;
-    context->depth = 0;
-    context->tree_heapsize = 0;
-    context->tree_heap[1] = 0;
+    used = 0;
 
     for (i = 0; i < nparm; i++) {
         context->len[i] = 0;
         if (freqparm[i])
-            context->tree_heap[++context->tree_heapsize] = i;
+            context->tree_keys[used++] = ((uint32_t)freqparm[i] << 16) | i;
     }
 
-    if (context->tree_heapsize < 2) {
-        if (!context->tree_heapsize) {
-            codeparm[context->tree_heap[1]] = 0;
+    if (used < 2) {
+        if (!used) {
+            codeparm[0] = 0;
             return;
         }
 
-        if (!context->tree_heap[1])
+        if (!(context->tree_keys[0] & 0xFFFF))
             freqparm[1] = 1;
         else
             freqparm[0] = 1;
@@ -752,15 +965,16 @@ RedoTree:
         goto RedoTree;
     }
 
-    make_tree2(context, avail, freqparm, codeparm);
+    qsort(context->tree_keys, used, sizeof(context->tree_keys[0]), compare_tree_keys);
+    make_len(context, used, max_len);
 
     if (make_codes)
         make_code(context, nparm, (char*)lenparm, codeparm);
 }
 static void create_trees(ENCODER_CONTEXT* context, bool generate_codes) {
-    make_tree(context, NUM_CHARS + (context->num_position_slots * (LZX_NUM_PRIMARY_LEN + 1)), context->main_tree_freq, context->main_tree_len, context->main_tree_code, generate_codes);
-    make_tree(context, LZX_NUM_SECONDARY_LEN, context->secondary_tree_freq, context->secondary_tree_len, context->secondary_tree_code, generate_codes);
-    make_tree(context, LZX_ALIGNED_NUM_ELEMENTS, context->aligned_tree_freq, context->aligned_tree_len, context->aligned_tree_code, true);
+    make_tree(context, NUM_CHARS + (context->num_position_slots * (LZX_NUM_PRIMARY_LEN + 1)), context->main_tree_freq, context->main_tree_len, context->main_tree_code, LZX_MAX_TREE_LEN, generate_codes);
+    make_tree(context, LZX_NUM_SECONDARY_LEN, context->secondary_tree_freq, context->secondary_tree_len, context->secondary_tree_code, LZX_MAX_TREE_LEN, generate_codes);
+    make_tree(context, LZX_ALIGNED_NUM_ELEMENTS, context->aligned_tree_freq, context->aligned_tree_len, context->aligned_tree_code, LZX_MAX_ALIGNED_TREE_LEN, true);
 }
 
 static uint32_t tally_frequency(ENCODER_CONTEXT* context, uint32_t start, uint32_t start_at, uint32_t end) {
@@ -816,6 +1030,12 @@ static uint32_t get_block_stats(ENCODER_CONTEXT* context, uint32_t start, uint32
     return tally_frequency(context, start, start_at, end);
 }
 static void update_tree_estimates(ENCODER_CONTEXT* context) {
+    // the previous pass's trees are better than an estimate.
+    if (context->pass_cost_count > 0) {
+        context->pass_cost_dirty = true;
+        return;
+    }
+
     if (context->literals) {
         if (context->need_to_recalc_stats) {
             get_block_stats(context, 0, 0, context->literals);
@@ -896,7 +1116,7 @@ static void write_rep_tree(ENCODER_CONTEXT* context, uint8_t* pLen, uint8_t* pLa
     int i;
     int	j;
     int	same;
-    uint16_t small_freq[2 * 24] = {0};
+    uint16_t small_freq[24] = {0};
     uint16_t mini_code[24] = {0};
     char mini_len[24] = {0};
 
@@ -936,7 +1156,7 @@ static void write_rep_tree(ENCODER_CONTEXT* context, uint8_t* pLen, uint8_t* pLa
         }
     }
 
-    make_tree(context, 20, small_freq, (uint8_t*)mini_len, mini_code, true);
+    make_tree(context, 20, small_freq, (uint8_t*)mini_len, mini_code, LZX_MAX_PRETREE_LEN, true);
 
     for (i = 0; i < 20; i++) {
         output_bits(context, 4, mini_len[i]);
@@ -995,7 +1215,7 @@ static void encode_trees(ENCODER_CONTEXT* context) {
     write_rep_tree(context, context->secondary_tree_len, context->secondary_tree_prev_len, LZX_NUM_SECONDARY_LEN);
 }
 static void encode_aligned_tree(ENCODER_CONTEXT* context) {
-    make_tree(context, LZX_ALIGNED_NUM_ELEMENTS, context->aligned_tree_freq, context->aligned_tree_len, context->aligned_tree_code, true);
+    make_tree(context, LZX_ALIGNED_NUM_ELEMENTS, context->aligned_tree_freq, context->aligned_tree_len, context->aligned_tree_code, LZX_MAX_ALIGNED_TREE_LEN, true);
     for (int i = 0; i < 8; i++) {
         output_bits(context, 3, context->aligned_tree_len[i]);
     }
@@ -1019,16 +1239,19 @@ static void encode_verbatim_block(ENCODER_CONTEXT* context, uint32_t literals) {
             match_pos = context->dist_data[d++];
             mp_slot = (uint8_t)MP_SLOT(match_pos);
 
+            // the length codes are at most 32 bits together; the offset bits go in a second batch.
             if (match_len < LZX_NUM_PRIMARY_LEN) {
-                OUTPUT_BITS(context->main_tree_len[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len], context->main_tree_code[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len]);
+                PUT_BITS(context->main_tree_len[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len], context->main_tree_code[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len]);
             }
             else {
-                OUTPUT_BITS(context->main_tree_len[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)], context->main_tree_code[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)]);
-                OUTPUT_BITS(context->secondary_tree_len[match_len - LZX_NUM_PRIMARY_LEN], context->secondary_tree_code[match_len - LZX_NUM_PRIMARY_LEN]);
+                PUT_BITS(context->main_tree_len[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)], context->main_tree_code[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)]);
+                PUT_BITS(context->secondary_tree_len[match_len - LZX_NUM_PRIMARY_LEN], context->secondary_tree_code[match_len - LZX_NUM_PRIMARY_LEN]);
             }
+            FLUSH_BITS();
 
             if (lzx_extra_bits[mp_slot]) {
-                OUTPUT_BITS(lzx_extra_bits[mp_slot], match_pos & slot_mask[mp_slot]);
+                PUT_BITS(lzx_extra_bits[mp_slot], match_pos & slot_mask[mp_slot]);
+                FLUSH_BITS();
             }
 
             context->input_running_total += (match_len + LZX_MIN_MATCH);
@@ -1059,25 +1282,29 @@ static void encode_aligned_block(ENCODER_CONTEXT* context, uint32_t literals) {
             match_pos = context->dist_data[d++];
             mp_slot = (uint8_t)MP_SLOT(match_pos);
 
+            // the length codes are at most 32 bits together; the offset bits go in a second batch.
             if (match_len < LZX_NUM_PRIMARY_LEN) {
-                OUTPUT_BITS(context->main_tree_len[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len], context->main_tree_code[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len]);
+                PUT_BITS(context->main_tree_len[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len], context->main_tree_code[NUM_CHARS + (mp_slot << NL_SHIFT) + match_len]);
             }
             else {
-                OUTPUT_BITS(context->main_tree_len[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)], context->main_tree_code[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)]);
-                OUTPUT_BITS(context->secondary_tree_len[match_len - LZX_NUM_PRIMARY_LEN], context->secondary_tree_code[match_len - LZX_NUM_PRIMARY_LEN]);
+                PUT_BITS(context->main_tree_len[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)], context->main_tree_code[(NUM_CHARS + LZX_NUM_PRIMARY_LEN) + (mp_slot << NL_SHIFT)]);
+                PUT_BITS(context->secondary_tree_len[match_len - LZX_NUM_PRIMARY_LEN], context->secondary_tree_code[match_len - LZX_NUM_PRIMARY_LEN]);
             }
+            FLUSH_BITS();
 
             if (lzx_extra_bits[mp_slot] >= 3) {
                 if (lzx_extra_bits[mp_slot] > 3) {
-                    OUTPUT_BITS(lzx_extra_bits[mp_slot] - 3, (match_pos >> 3) & ((1 << (lzx_extra_bits[mp_slot] - 3)) - 1));
+                    PUT_BITS(lzx_extra_bits[mp_slot] - 3, (match_pos >> 3) & ((1 << (lzx_extra_bits[mp_slot] - 3)) - 1));
                 }
 
                 lower = (uint8_t)(match_pos & 7);
 
-                OUTPUT_BITS(context->aligned_tree_len[lower], context->aligned_tree_code[lower]);
+                PUT_BITS(context->aligned_tree_len[lower], context->aligned_tree_code[lower]);
+                FLUSH_BITS();
             }
             else if (lzx_extra_bits[mp_slot]) {
-                OUTPUT_BITS(lzx_extra_bits[mp_slot], match_pos & slot_mask[mp_slot]);
+                PUT_BITS(lzx_extra_bits[mp_slot], match_pos & slot_mask[mp_slot]);
+                FLUSH_BITS();
             }
 
             context->input_running_total += (match_len + LZX_MIN_MATCH);
@@ -1093,10 +1320,10 @@ static void encode_uncompressed_block(ENCODER_CONTEXT* context, uint32_t bufpos,
     bool block_size_odd;
     uint32_t val;
 
-    output_bits(context, context->bitcount - 16, 0);
+    align_output_bits(context, true);
     for (int i = 0; i < NUM_REPEATED_OFFSETS; i++) {
         val = context->repeated_offset_at_literal_zero[i];
-        for (int j = 0; j < sizeof(long); j++) {
+        for (int j = 0; j < sizeof(uint32_t); j++) {
             *context->output_buffer_curpos++ = (uint8_t)val;
             val >>= 8;
         }
@@ -1119,22 +1346,21 @@ static void encode_uncompressed_block(ENCODER_CONTEXT* context, uint32_t bufpos,
         *context->output_buffer_curpos++ = 0;
     }
 
-    context->bitcount = 32;
+    context->bitcount = 64;
     context->bitbuf = 0;
 }
 
+static long find_repeated_offsets(ENCODER_CONTEXT* context, long buf_pos, int match_length);
+
 static long binary_search_findmatch(ENCODER_CONTEXT* context, long buf_pos) {
     uint32_t ptr;
-    uint32_t a, b;
     uint32_t* small_ptr, * big_ptr;
     uint32_t end_pos;
     int val;
-    int bytes_to_boundary;
     int clen;
     int same;
     int match_length;
     int small_len, big_len;
-    int i, best_repeated_offset;
     uint16_t tree_to_use;
 
     tree_to_use = *((uint16_t*)&context->mem_window[buf_pos]);
@@ -1158,14 +1384,11 @@ static long binary_search_findmatch(ENCODER_CONTEXT* context, long buf_pos) {
     big_ptr = &context->right[buf_pos];
 
     do {
-        same = clen;
-        a = ptr + clen;
-        b = buf_pos + clen;
+        same = context->match_len(&context->mem_window[ptr], &context->mem_window[buf_pos], clen, LZX_MAX_MATCH);
+        if (same >= LZX_MAX_MATCH)
+            goto long_match;
 
-        while ((val = ((int)context->mem_window[a++]) - ((int)context->mem_window[b++])) == 0) {
-            if (++same >= LZX_MAX_MATCH)
-                goto long_match;
-        }
+        val = ((int)context->mem_window[ptr + same]) - ((int)context->mem_window[buf_pos + same]);
 
         if (val < 0) {
             if (same > big_len) {
@@ -1222,6 +1445,14 @@ static long binary_search_findmatch(ENCODER_CONTEXT* context, long buf_pos) {
 
 end_bsearch:
 
+    return find_repeated_offsets(context, buf_pos, match_length);
+}
+static long find_repeated_offsets(ENCODER_CONTEXT* context, long buf_pos, int match_length) {
+    // check the repeated offsets against the match found by the match finder; a repeated offset
+    // that matches atleast as much replaces the match position. clamp the match to the chunk boundary.
+    int i, best_repeated_offset;
+    int bytes_to_boundary;
+
     for (i = 0; i < match_length; i++) {
         if (context->mem_window[buf_pos + i] != context->mem_window[buf_pos - context->last_matchpos_offset[0] + i])
             break;
@@ -1326,7 +1557,6 @@ static void binary_search_remove_node(ENCODER_CONTEXT* context, long buf_pos, ui
     }
 }
 static void quick_insert_bsearch_findmatch(ENCODER_CONTEXT* context, long buf_pos, long end_pos) {
-    uint32_t a, b;
     uint32_t* small_ptr;
     uint32_t* big_ptr;
     int val;
@@ -1352,14 +1582,11 @@ static void quick_insert_bsearch_findmatch(ENCODER_CONTEXT* context, long buf_po
     big_ptr = &context->right[buf_pos];
 
     do {
-        same = clen;
-        a = ptr + clen;
-        b = buf_pos + clen;
-
-        while ((val = ((int)context->mem_window[a++]) - ((int)context->mem_window[b++])) == 0) {
-            if (++same >= BREAK_LENGTH)
-                break;
-        }
+        same = context->match_len(&context->mem_window[ptr], &context->mem_window[buf_pos], clen, BREAK_LENGTH);
+        if (same >= BREAK_LENGTH)
+            val = 0;
+        else
+            val = ((int)context->mem_window[ptr + same]) - ((int)context->mem_window[buf_pos + same]);
 
         if (val < 0) {
             if (same > big_len) {
@@ -1401,9 +1628,125 @@ static void quick_insert_bsearch_findmatch(ENCODER_CONTEXT* context, long buf_po
     *big_ptr = 0;
 }
 
+static long hash_chain_findmatch(ENCODER_CONTEXT* context, long buf_pos) {
+    uint32_t ptr;
+    uint32_t end_pos;
+    uint32_t depth;
+    int same;
+    int match_length;
+    uint16_t hash;
+
+    hash = HASH3(context->mem_window, buf_pos);
+    ptr = context->tree_root[hash];
+    context->tree_root[hash] = buf_pos;
+    context->left[buf_pos] = ptr;
+
+    end_pos = buf_pos - (context->window_size - 4);
+
+    match_length = 1;
+    depth = HASH_CHAIN_DEPTH;
+
+    while (ptr > end_pos && depth-- > 0) {
+        if (context->mem_window[ptr + match_length] == context->mem_window[buf_pos + match_length]) {
+            same = context->match_len(&context->mem_window[ptr], &context->mem_window[buf_pos], 0, LZX_MAX_MATCH);
+
+            if (same > match_length) {
+                do {
+                    context->matchpos_table[++match_length] = buf_pos - ptr + (NUM_REPEATED_OFFSETS - 1);
+                } 
+                while (match_length < same);
+
+                if (same >= BREAK_LENGTH)
+                    break;
+            }
+        }
+
+        ptr = context->left[ptr];
+    }
+
+    if (match_length < LZX_MIN_MATCH)
+        return 0;
+
+    return find_repeated_offsets(context, buf_pos, match_length);
+}
+static void hash_chain_insert(ENCODER_CONTEXT* context, long buf_pos, long end_pos) {
+    uint16_t hash = HASH3(context->mem_window, buf_pos);
+    (void)end_pos;
+    context->left[buf_pos] = context->tree_root[hash];
+    context->tree_root[hash] = buf_pos;
+}
+static void hash_chain_remove_node(ENCODER_CONTEXT* context, long buf_pos, uint32_t end_pos) {
+    uint16_t hash = HASH3(context->mem_window, buf_pos);
+    (void)end_pos;
+    if (context->tree_root[hash] == (uint32_t)buf_pos) {
+        context->tree_root[hash] = context->left[buf_pos];
+    }
+}
+
+static long hash_table_findmatch(ENCODER_CONTEXT* context, long buf_pos) {
+    uint32_t ptr;
+    uint32_t end_pos;
+    int same;
+    int match_length;
+    uint16_t hash;
+
+    hash = HASH3(context->mem_window, buf_pos);
+    ptr = context->tree_root[hash];
+    context->tree_root[hash] = buf_pos;
+
+    end_pos = buf_pos - (context->window_size - 4);
+    if (ptr <= end_pos)
+        return 0;
+
+    same = context->match_len(&context->mem_window[ptr], &context->mem_window[buf_pos], 0, LZX_MAX_MATCH);
+
+    if (same < LZX_MIN_MATCH)
+        return 0;
+
+    for (match_length = LZX_MIN_MATCH; match_length <= same; match_length++) {
+        context->matchpos_table[match_length] = buf_pos - ptr + (NUM_REPEATED_OFFSETS - 1);
+    }
+
+    return find_repeated_offsets(context, buf_pos, same);
+}
+static void hash_table_insert(ENCODER_CONTEXT* context, long buf_pos, long end_pos) {
+    (void)end_pos;
+    context->tree_root[HASH3(context->mem_window, buf_pos)] = buf_pos;
+}
+static void hash_table_remove_node(ENCODER_CONTEXT* context, long buf_pos, uint32_t end_pos) {
+    uint16_t hash = HASH3(context->mem_window, buf_pos);
+    (void)end_pos;
+    if (context->tree_root[hash] == (uint32_t)buf_pos) {
+        context->tree_root[hash] = 0;
+    }
+}
+
+static void init_match_finder(ENCODER_CONTEXT* context) {
+    context->match_len = lzx_get_match_len_proc();
+
+    switch (context->match_finder) {
+        case LZX_MATCH_FINDER_HASH_CHAIN:
+            context->findmatch = hash_chain_findmatch;
+            context->insert_node = hash_chain_insert;
+            context->remove_node = hash_chain_remove_node;
+            break;
+        case LZX_MATCH_FINDER_HASH_TABLE:
+            context->findmatch = hash_table_findmatch;
+            context->insert_node = hash_table_insert;
+            context->remove_node = hash_table_remove_node;
+            break;
+        default:
+            context->match_finder = LZX_MATCH_FINDER_BINARY_TREE;
+            context->findmatch = binary_search_findmatch;
+            context->insert_node = quick_insert_bsearch_findmatch;
+            context->remove_node = binary_search_remove_node;
+            break;
+    }
+}
+
 static void get_final_repeated_offset_states(ENCODER_CONTEXT* context, uint32_t distances) {
     uint8_t consecutive = 0;
-    long d = distances - 1;
+    long d = (long)distances - 1;
 
     for (; d >= 0; d--) {
         if (context->dist_data[d] > 2)
@@ -1442,12 +1785,55 @@ static void get_final_repeated_offset_states(ENCODER_CONTEXT* context, uint32_t
         }
     }
 }
+static void record_pass_cost(ENCODER_CONTEXT* context, uint32_t bufpos) {
+    LZX_PASS_COST* new_record = NULL;
+    uint32_t capacity = 0;
+
+    if (context->pass_record_count >= context->pass_record_capacity) {
+        capacity = (context->pass_record_capacity == 0) ? 64 : context->pass_record_capacity * 2;
+        new_record = (LZX_PASS_COST*)realloc(context->pass_record, sizeof(LZX_PASS_COST) * capacity);
+        if (new_record == NULL) {
+            context->output_error = LZX_ERROR_OUT_OF_MEMORY;
+            return;
+        }
+        context->pass_record = new_record;
+        context->pass_record_capacity = capacity;
+    }
+
+    context->pass_record[context->pass_record_count].bufpos = bufpos;
+    memcpy(context->pass_record[context->pass_record_count].main_tree_len, context->main_tree_len, LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
+    memcpy(context->pass_record[context->pass_record_count].secondary_tree_len, context->secondary_tree_len, LZX_NUM_SECONDARY_LEN);
+    context->pass_record_count++;
+}
+static void apply_pass_cost(ENCODER_CONTEXT* context, uint32_t buf_pos) {
+    // price the parse with the trees the previous pass built for the block covering buf_pos.
+    uint32_t i = context->pass_cost_index;
+
+    // redo_first_block() can move buf_pos back.
+    while (i > 0 && context->pass_costs[i].bufpos > buf_pos)
+        i--;
+    while (i + 1 < context->pass_cost_count && context->pass_costs[i + 1].bufpos <= buf_pos)
+        i++;
+
+    memcpy(context->main_tree_len, context->pass_costs[i].main_tree_len, LZX_MAIN_TREE_ELEMENTS(context->num_position_slots));
+    memcpy(context->secondary_tree_len, context->pass_costs[i].secondary_tree_len, LZX_NUM_SECONDARY_LEN);
+    fix_tree_cost_estimates(context);
+
+    context->pass_cost_index = i;
+    context->pass_cost_next_bufpos = (i + 1 < context->pass_cost_count) ? context->pass_costs[i + 1].bufpos : 0xFFFFFFFF;
+    context->pass_cost_dirty = false;
+}
+
 static void do_block_output(ENCODER_CONTEXT* context, long end, long distance_to_end_at) {
     uint32_t bytes_compressed = get_block_stats(context, 0, 0, end);
     int block_type = get_aligned_stats(context, distance_to_end_at);
 
     create_trees(context, true);
 
+    if (context->pass_recording) {
+        record_pass_cost(context, context->bufpos_at_last_block);
+    }
+
     uint32_t estimated_block_size = estimate_compressed_block_size(context);
     if (estimated_block_size >= bytes_compressed) {
         if (context->bufpos_at_last_block >= context->earliest_window_data_remaining) {
@@ -1504,6 +1890,7 @@ static void output_block(ENCODER_CONTEXT* context) {
     }
 
     fix_tree_cost_estimates(context);
+    context->pass_cost_dirty = true;
 }
 static void block_end(ENCODER_CONTEXT* context, long buf_pos) {
     context->first_block = false;
@@ -1579,21 +1966,14 @@ static bool redo_first_block(ENCODER_CONTEXT* context, uint32_t* bufpos_ptr) {
     context->need_to_recalc_stats = true;
 
     context->next_tree_create = split_at_literal;
+    context->pass_cost_dirty = true;
 
     *bufpos_ptr = start_at;
 
     return true;
 }
-static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
-    uint32_t real_buf_pos;
-    uint32_t buf_pos_end_this_chunk;
-    uint32_t match_pos;
+static void encode_chunk_start(ENCODER_CONTEXT* context, uint32_t buf_pos) {
     uint32_t i;
-    uint32_t end_pos;
-    int enc_match_len;
-
-    uint32_t buf_pos = context->bufpos;
-    uint32_t buf_pos_end = context->bufpos + bytes_read;
 
     if (context->first_time_this_group) {
         context->first_time_this_group = false;
@@ -1611,44 +1991,201 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
     }
     else {
         for (i = BREAK_LENGTH; i > 0; --i) {
-            quick_insert_bsearch_findmatch(context, (buf_pos - (long)i), (buf_pos - context->window_size + 4));
+            context->insert_node(context, (buf_pos - (long)i), (buf_pos - context->window_size + 4));
         }
     }
+}
+static void slide_window(ENCODER_CONTEXT* context, uint32_t buf_pos) {
+    memmove(&context->real_mem_window[0], &context->real_mem_window[context->encoder_second_partition_size], context->window_size);
+    if (context->real_left != NULL)
+        memmove(&context->real_left[0], &context->real_left[context->encoder_second_partition_size], sizeof(uint32_t) * context->window_size);
+    if (context->real_right != NULL)
+        memmove(&context->real_right[0], &context->real_right[context->encoder_second_partition_size], sizeof(uint32_t) * context->window_size);
 
-    while (1) {
-    top_of_main_loop:
-        while (buf_pos < buf_pos_end) {
-            buf_pos_end_this_chunk = (buf_pos + LZX_CHUNK_SIZE) & ~(LZX_CHUNK_SIZE - 1);
+    context->earliest_window_data_remaining = buf_pos - context->window_size;
+    context->mem_window -= context->encoder_second_partition_size;
+    if (context->left != NULL)
+        context->left -= context->encoder_second_partition_size;
+    if (context->right != NULL)
+        context->right -= context->encoder_second_partition_size;
+}
+static void insert_match_nodes(ENCODER_CONTEXT* context, uint32_t buf_pos, uint32_t match_len, uint32_t match_pos) {
+    // insert the positions covered by a match into the match finder.
+    uint32_t i;
+    if (match_pos == 3 && match_len > 16) {
+        context->insert_node(context, buf_pos + 1, buf_pos - context->window_size + 5);
+    }
+    else {
+        for (i = 1; i < match_len; i++)
+            context->insert_node(context, buf_pos + i, buf_pos + i - context->window_size + 4);
+    }
+}
+static void update_repeated_offsets(ENCODER_CONTEXT* context, uint32_t match_pos) {
+    if (match_pos >= NUM_REPEATED_OFFSETS) {
+        context->last_matchpos_offset[2] = context->last_matchpos_offset[1];
+        context->last_matchpos_offset[1] = context->last_matchpos_offset[0];
+        context->last_matchpos_offset[0] = match_pos - (NUM_REPEATED_OFFSETS - 1);
+    }
+    else if (match_pos) {
+        uint32_t t = context->last_matchpos_offset[0];
+        context->last_matchpos_offset[0] = context->last_matchpos_offset[match_pos];
+        context->last_matchpos_offset[match_pos] = t;
+    }
+}
+static int find_chunk_match(ENCODER_CONTEXT* context, uint32_t buf_pos, uint32_t buf_pos_end_this_chunk) {
+    // find a match that does not cross the end of the chunk.
+    int match_len = context->findmatch(context, buf_pos);
 
-            if (buf_pos_end_this_chunk > buf_pos_end)
-                buf_pos_end_this_chunk = buf_pos_end;
+    if ((uint32_t)match_len + buf_pos > buf_pos_end_this_chunk) {
+        match_len = buf_pos_end_this_chunk - buf_pos;
+        if (match_len < LZX_MIN_MATCH)
+            match_len = 0;
+    }
 
-            enc_match_len = binary_search_findmatch(context, buf_pos);
+    // a short match that is far away costs more than the literals.
+    if (match_len == LZX_MIN_MATCH && context->matchpos_table[LZX_MIN_MATCH] >= BREAK_MAX_LENGTH_TWO_OFFSET)
+        match_len = 0;
 
-            if (enc_match_len < LZX_MIN_MATCH) {
-            output_literal:
-                context->lit_data[context->literals++] = context->mem_window[buf_pos];
-                buf_pos++;
-                if (context->literals >= (MAX_LITERAL_ITEMS - 8))
-                    block_end(context, buf_pos);
-                continue;
-            }
+    return match_len;
+}
+static void lazy_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
+    // greedy and lazy parse. take the longest match at each position; a lazy parse first checks
+    // if the match at the next position(s) is longer and outputs a literal if it is.
 
-            if ((uint32_t)enc_match_len + buf_pos > buf_pos_end_this_chunk) {
-                enc_match_len = buf_pos_end_this_chunk - buf_pos;
+    uint32_t buf_pos_end_this_chunk;
+    uint32_t match_pos;
+    uint32_t inserted_to;
+    uint32_t i;
+    int lazy_steps;
+    int step;
+    int match_len;
+    int next_match_len;
 
-                if (enc_match_len < LZX_MIN_MATCH)
-                    goto output_literal;
-            }
+    uint32_t buf_pos = context->bufpos;
+    uint32_t buf_pos_end = context->bufpos + bytes_read;
 
-            if (enc_match_len < FAST_DECISION_THRESHOLD) {
-                uint32_t span, epos, bpos, NextPrevPos;
-                DECISION_NODE* decision_node_ptr;
-                long iterations;
+    lazy_steps = (context->level == LZX_LEVEL_GREEDY) ? 0 : (context->level == LZX_LEVEL_LAZY) ? 1 : 2;
 
-                span = buf_pos + enc_match_len;
-                epos = buf_pos + LOOK;
-                bpos = buf_pos;
+    // the cost estimates are not used by these parsers; there is nothing to gain from redoing the first block.
+    context->first_block = false;
+
+    encode_chunk_start(context, buf_pos);
+
+    while (buf_pos < buf_pos_end) {
+        buf_pos_end_this_chunk = (buf_pos + LZX_CHUNK_SIZE) & ~(LZX_CHUNK_SIZE - 1);
+
+        if (buf_pos_end_this_chunk > buf_pos_end)
+            buf_pos_end_this_chunk = buf_pos_end;
+
+        match_len = find_chunk_match(context, buf_pos, buf_pos_end_this_chunk);
+        match_pos = context->matchpos_table[match_len];
+        inserted_to = buf_pos;
+
+        for (step = 0; step < lazy_steps && match_len >= LZX_MIN_MATCH && match_len < BREAK_LENGTH; step++) {
+            next_match_len = find_chunk_match(context, buf_pos + 1, buf_pos_end_this_chunk);
+            inserted_to = buf_pos + 1;
+
+            if (next_match_len <= match_len)
+                break;
+
+            context->lit_data[context->literals++] = context->mem_window[buf_pos];
+            buf_pos++;
+
+            match_len = next_match_len;
+            match_pos = context->matchpos_table[match_len];
+
+            if (context->literals >= (MAX_LITERAL_ITEMS - 8))
+                block_end(context, buf_pos);
+        }
+
+        if (match_len < LZX_MIN_MATCH) {
+            context->lit_data[context->literals++] = context->mem_window[buf_pos];
+            buf_pos++;
+        }
+        else {
+            OUT_MATCH(match_len, match_pos);
+
+            // the look ahead already inserted the next position.
+            if (inserted_to > buf_pos) {
+                for (i = inserted_to - buf_pos + 1; i < (uint32_t)match_len; i++)
+                    context->insert_node(context, buf_pos + i, buf_pos + i - context->window_size + 4);
+            }
+            else {
+                insert_match_nodes(context, buf_pos, match_len, match_pos);
+            }
+
+            update_repeated_offsets(context, match_pos);
+            buf_pos += match_len;
+        }
+
+        if (context->literals >= (MAX_LITERAL_ITEMS - 8) || context->distances >= (MAX_DIST_ITEMS - 8))
+            block_end(context, buf_pos);
+    }
+
+    context->earliest_window_data_remaining = buf_pos - context->window_size;
+
+    if (bytes_read == LZX_CHUNK_SIZE) {
+        uint32_t end_pos = buf_pos - (context->window_size - 4 - BREAK_LENGTH);
+
+        for (i = 1; (i <= BREAK_LENGTH); i++)
+            context->remove_node(context, buf_pos - i, end_pos);
+
+        if (buf_pos - (uint32_t)(context->real_mem_window - context->mem_window) >= context->window_size + context->encoder_second_partition_size)
+            slide_window(context, buf_pos);
+    }
+
+    context->bufpos = buf_pos;
+}
+static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
+    uint32_t real_buf_pos;
+    uint32_t buf_pos_end_this_chunk;
+    uint32_t match_pos;
+    uint32_t i;
+    uint32_t end_pos;
+    int enc_match_len;
+
+    uint32_t buf_pos = context->bufpos;
+    uint32_t buf_pos_end = context->bufpos + bytes_read;
+
+    encode_chunk_start(context, buf_pos);
+
+    while (1) {
+    top_of_main_loop:
+        while (buf_pos < buf_pos_end) {
+            buf_pos_end_this_chunk = (buf_pos + LZX_CHUNK_SIZE) & ~(LZX_CHUNK_SIZE - 1);
+
+            if (buf_pos_end_this_chunk > buf_pos_end)
+                buf_pos_end_this_chunk = buf_pos_end;
+
+            if (context->pass_cost_count > 0 && (context->pass_cost_dirty || buf_pos >= context->pass_cost_next_bufpos))
+                apply_pass_cost(context, buf_pos);
+
+            enc_match_len = context->findmatch(context, buf_pos);
+
+            if (enc_match_len < LZX_MIN_MATCH) {
+            output_literal:
+                context->lit_data[context->literals++] = context->mem_window[buf_pos];
+                buf_pos++;
+                if (context->literals >= (MAX_LITERAL_ITEMS - 8))
+                    block_end(context, buf_pos);
+                continue;
+            }
+
+            if ((uint32_t)enc_match_len + buf_pos > buf_pos_end_this_chunk) {
+                enc_match_len = buf_pos_end_this_chunk - buf_pos;
+
+                if (enc_match_len < LZX_MIN_MATCH)
+                    goto output_literal;
+            }
+
+            if (enc_match_len < FAST_DECISION_THRESHOLD) {
+                uint32_t span, epos, bpos, NextPrevPos;
+                DECISION_NODE* decision_node_ptr;
+                long iterations;
+
+                span = buf_pos + enc_match_len;
+                epos = buf_pos + LOOK;
+                bpos = buf_pos;
 
                 context->decision_node[1].numbits = CHAR_EST(context->mem_window[buf_pos]);
                 context->decision_node[1].path = buf_pos;
@@ -1705,7 +2242,7 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
                     if (span == buf_pos)
                         break;
 
-                    enc_match_len = binary_search_findmatch(context, buf_pos);
+                    enc_match_len = context->findmatch(context, buf_pos);
 
                     if ((uint32_t)enc_match_len + buf_pos > buf_pos_end_this_chunk) {
                         enc_match_len = buf_pos_end_this_chunk - buf_pos;
@@ -1719,11 +2256,11 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
                         decision_node_ptr[buf_pos + enc_match_len].link = match_pos;
                         decision_node_ptr[buf_pos + enc_match_len].path = buf_pos;
                         if (match_pos == 3 && enc_match_len > 16) {
-                            quick_insert_bsearch_findmatch(context, buf_pos + 1, buf_pos - context->window_size + (1 + 4));
+                            context->insert_node(context, buf_pos + 1, buf_pos - context->window_size + (1 + 4));
                         }
                         else {
                             for (i = 1; i < (uint32_t)enc_match_len; i++)
-                                quick_insert_bsearch_findmatch(context, buf_pos + i, buf_pos + i - context->window_size + 4);
+                                context->insert_node(context, buf_pos + i, buf_pos + i - context->window_size + 4);
                         }
 
                         buf_pos += enc_match_len;
@@ -1811,11 +2348,11 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
             else {
                 match_pos = context->matchpos_table[enc_match_len];
                 if (match_pos == 3 && enc_match_len > 16) {
-                    quick_insert_bsearch_findmatch(context, buf_pos + 1, buf_pos - context->window_size + 5);
+                    context->insert_node(context, buf_pos + 1, buf_pos - context->window_size + 5);
                 }
                 else {
                     for (i = 1; i < (uint32_t)enc_match_len; i++) 
-                        quick_insert_bsearch_findmatch(context, buf_pos + i, buf_pos + i - context->window_size + 4);
+                        context->insert_node(context, buf_pos + i, buf_pos + i - context->window_size + 4);
                 }
 
                 buf_pos += enc_match_len;
@@ -1851,7 +2388,7 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
         end_pos = buf_pos - (context->window_size - 4 - BREAK_LENGTH);
 
         for (i = 1; (i <= BREAK_LENGTH); i++)
-            binary_search_remove_node(context, buf_pos - i, end_pos);
+            context->remove_node(context, buf_pos - i, end_pos);
 
         real_buf_pos = buf_pos - (uint32_t)(context->real_mem_window - context->mem_window);
 
@@ -1863,14 +2400,7 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
                 goto top_of_main_loop;
         }
 
-        memmove(&context->real_mem_window[0], &context->real_mem_window[context->encoder_second_partition_size], context->window_size);
-        memmove(&context->real_left[0], &context->real_left[context->encoder_second_partition_size], sizeof(uint32_t) * context->window_size);
-        memmove(&context->real_right[0], &context->real_right[context->encoder_second_partition_size], sizeof(uint32_t) * context->window_size);
-
-        context->earliest_window_data_remaining = buf_pos - context->window_size;
-        context->mem_window -= context->encoder_second_partition_size;
-        context->left -= context->encoder_second_partition_size;
-        context->right -= context->encoder_second_partition_size;
+        slide_window(context, buf_pos);
 
         break;
     }
@@ -1878,15 +2408,48 @@ static void opt_encode_top(ENCODER_CONTEXT* context, long bytes_read) {
     context->bufpos = buf_pos;
 }
 
+static bool reserve_output(ENCODER_CONTEXT* context, uint32_t size) {
+    uint8_t* new_buffer = NULL;
+    uint32_t used = 0;
+    uint32_t capacity = 0;
+
+    // capacity is unknown; the caller sized the buffer with lzx_compress_bound()
+    if (context->output_buffer_capacity == 0)
+        return true;
+
+    used = (uint32_t)(context->output_buffer - context->output_buffer_base);
+    if (used + size <= context->output_buffer_capacity)
+        return true;
+
+    if (context->output_buffer_grow == false) {
+        context->output_overflow = true;
+        return false;
+    }
+
+    // grow geometrically so a stream that doesn't compress only reallocs a few times
+    capacity = context->output_buffer_capacity * 2;
+    if (capacity < used + size)
+        capacity = used + size;
+
+    new_buffer = (uint8_t*)realloc(context->output_buffer_base, capacity);
+    if (new_buffer == NULL) {
+        context->output_error = LZX_ERROR_OUT_OF_MEMORY;
+        return false;
+    }
+
+    context->output_buffer_base = new_buffer;
+    context->output_buffer = new_buffer + used;
+    context->output_buffer_capacity = capacity;
+    return true;
+}
+
 static void encode_flush(ENCODER_CONTEXT* context) {
     long output_size = 0;
     LZX_BLOCK block;
 
     if (context->input_running_total > 0) {
         // output the bit buffer
-        if (context->bitcount < 32) {
-            output_bits(context, (context->bitcount - 16), 0);
-        }
+        align_output_bits(context, false);
 
         output_size = (long)(context->output_buffer_curpos - context->output_buffer_start);
 
@@ -1894,6 +2457,22 @@ static void encode_flush(ENCODER_CONTEXT* context) {
             block.compressed_size = (uint16_t)(context->output_buffer_curpos - context->output_buffer_start);
             block.uncompressed_size = (uint16_t)context->input_running_total;
             
+            // streaming; write the frame straight to the output fd
+            if (context->output_fd != -1) {
+                if (writeFd(context->output_fd, &block, sizeof(LZX_BLOCK)) != 0 ||
+                    writeFd(context->output_fd, context->output_buffer_start, block.compressed_size) != 0) {
+                    context->output_error = LZX_ERROR_IO;
+                }
+                context->output_buffer_size += sizeof(LZX_BLOCK) + block.compressed_size;
+                context->output_buffer_block_count++;
+                goto reset_output;
+            }
+
+            // make sure the frame fits in the output buffer
+            if (reserve_output(context, sizeof(LZX_BLOCK) + block.compressed_size) == false) {
+                goto reset_output;
+            }
+
             context->output_buffer_size += sizeof(LZX_BLOCK) + block.compressed_size;
             context->output_buffer_block_count++;
 
@@ -1909,22 +2488,28 @@ static void encode_flush(ENCODER_CONTEXT* context) {
         }
     }
 
+reset_output:
+
     // reset the output buffer
     context->input_running_total = 0;
     context->output_buffer_curpos = context->output_buffer_start;
-    context->bitcount = 32;
+    context->bitcount = 64;
     context->bitbuf = 0;
 }
 static void encode_start(ENCODER_CONTEXT* context) {
     long buf_pos = context->bufpos - (long)(context->real_mem_window - context->mem_window);
     long bytes_read = read_input(context, buf_pos, LZX_CHUNK_SIZE);
-    if (bytes_read > 0)
-        opt_encode_top(context, bytes_read);
+    if (bytes_read > 0) {
+        if (context->level >= LZX_LEVEL_OPTIMAL)
+            opt_encode_top(context, bytes_read);
+        else
+            lazy_encode_top(context, bytes_read);
+    }
 }
 static long encode_data(ENCODER_CONTEXT* context, long input_size) {
     context->input_ptr = context->input_buffer;
     context->input_left = input_size;
-    context->file_size_for_translation = DEFAULT_FILE_XLAT_SIZE;
+    context->file_size_for_translation = context->e8_translation ? DEFAULT_FILE_XLAT_SIZE : 0;
 
     encode_start(context);
 
@@ -1932,14 +2517,32 @@ static long encode_data(ENCODER_CONTEXT* context, long input_size) {
         return LZX_ERROR_BUFFER_OVERFLOW;
     }
 
+    if (context->output_error != 0) {
+        return context->output_error;
+    }
+
     return 0;
 }
-static bool encode_init(ENCODER_CONTEXT* context, uint8_t* dest) {
+static bool encode_init(ENCODER_CONTEXT* context, uint8_t* dest, const LZX_COMPRESSION_PARAMS* params) {
     context->window_size = LZX_WINDOW_SIZE;
+    context->match_finder = (params != NULL) ? params->match_finder : LZX_MATCH_FINDER_BINARY_TREE;
+    context->level = (params != NULL) ? params->level : LZX_LEVEL_OPTIMAL;
+    if (context->level < LZX_LEVEL_GREEDY || context->level > LZX_LEVEL_ULTRA)
+        context->level = LZX_LEVEL_OPTIMAL;
+    context->max_block_splits = (params != NULL && params->max_block_splits >= 0 && params->max_block_splits <= 255) ? (uint8_t)params->max_block_splits : LZX_DEFAULT_MAX_BLOCK_SPLITS;
+    context->split_min_gain = (params != NULL && params->split_min_gain > 0) ? params->split_min_gain : LZX_DEFAULT_SPLIT_MIN_GAIN;
+    context->e8_translation = (params != NULL) ? params->e8_translation : true;
+    init_match_finder(context);
+
     context->encoder_second_partition_size = SECONDARY_PARTITION_SIZE;
     context->output_buffer = dest;
     context->output_buffer_size = 0;
     context->output_buffer_block_count = 0;
+    context->output_buffer_base = dest;
+    context->output_buffer_capacity = 0;
+    context->output_buffer_grow = false;
+    context->output_fd = -1;
+    context->output_error = 0;
 
     if (alloc_compress_memory(context) == false)
         return false;
@@ -1956,12 +2559,20 @@ void lzx_flush_compression(ENCODER_CONTEXT* context) {
     encode_flush(context);
 }
 
-ENCODER_CONTEXT* lzx_create_compression(uint8_t* dest) {    
+void lzx_init_compression_params(LZX_COMPRESSION_PARAMS* params) {
+    params->match_finder = LZX_MATCH_FINDER_BINARY_TREE;
+    params->level = LZX_LEVEL_OPTIMAL;
+    params->max_block_splits = LZX_DEFAULT_MAX_BLOCK_SPLITS;
+    params->split_min_gain = LZX_DEFAULT_SPLIT_MIN_GAIN;
+    params->e8_translation = true;
+}
+
+ENCODER_CONTEXT* lzx_create_compression(uint8_t* dest, const LZX_COMPRESSION_PARAMS* params) {    
     ENCODER_CONTEXT* context = (ENCODER_CONTEXT*)malloc(sizeof(ENCODER_CONTEXT));
     if (context == NULL)
         return NULL;
 
-    if (encode_init(context, dest) == false) {
+    if (encode_init(context, dest, params) == false) {
         free(context);
         return NULL;
     }
@@ -1974,6 +2585,23 @@ void lzx_destroy_compression(ENCODER_CONTEXT* context) {
         free(context);
     }
 }
+void lzx_reset_compression(ENCODER_CONTEXT* context, uint8_t* dest) {
+    context->output_buffer = dest;
+    context->output_buffer_size = 0;
+    context->output_buffer_block_count = 0;
+    context->output_buffer_base = dest;
+    context->output_buffer_capacity = 0;
+    context->output_buffer_grow = false;
+    context->output_fd = -1;
+    context->output_error = 0;
+    context->output_buffer_curpos = context->output_buffer_start;
+    context->pass_cost_index = 0;
+    context->pass_cost_next_bufpos = 0;
+    context->pass_cost_dirty = true;
+    context->pass_record_count = 0;
+
+    init_compression_memory(context);
+}
 
 int lzx_compress_block(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t bytes_read) {   
     if (bytes_read > LZX_CHUNK_SIZE) {
@@ -1991,63 +2619,901 @@ int lzx_compress_next_block(ENCODER_CONTEXT* context, const uint8_t** src, uint3
     return result;
 }
 
-int lzx_compress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size) {
-    const uint8_t* src_ptr = NULL;
-    ENCODER_CONTEXT* context = NULL;
-    uint32_t bytes_read = 0;
-    uint32_t bytes_remaining = 0;
-    uint32_t total_compressed_size = 0;
+uint32_t lzx_compress_bound(const uint32_t src_size) {
+    // every frame holds at most one chunk of input and the encoder fails a frame
+    // rather than let it grow past LZX_OUTPUT_SIZE; incompressible chunks are
+    // written as uncompressed blocks well inside that limit.
+    uint32_t frames = (src_size + LZX_CHUNK_SIZE - 1) / LZX_CHUNK_SIZE;
+    return frames * (sizeof(LZX_BLOCK) + LZX_OUTPUT_SIZE);
+}
+
+static int compress_stream(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t offset, uint32_t size, uint8_t** dest, uint32_t* capacity, bool grow, uint32_t* output_size, bool* pad) {
+    // compress size bytes of src starting at offset into *dest. a stream that starts
+    // past the beginning of src is primed with the window before it.
+
+    const uint8_t* src_ptr = src + offset;
+    uint32_t bytes_remaining = size;
     int result = 0;
 
-    // Allocate a buffer if one was not provided
-    if (*dest == NULL) {
-        *dest = (uint8_t*)malloc(src_size);
-        if (*dest == NULL) {
+    lzx_reset_compression(context, *dest);
+    context->output_buffer_capacity = *capacity;
+    context->output_buffer_grow = grow;
+
+    if (offset > 0) {
+        prime_compression(context, src, offset, min(offset, LZX_WINDOW_SIZE));
+        encode_segment_start(context);
+    }
+
+    while (bytes_remaining > 0) {
+        result = lzx_compress_next_block(context, &src_ptr, min(LZX_CHUNK_SIZE, bytes_remaining), &bytes_remaining);
+        if (result != 0) {
+            goto Cleanup;
+        }
+    }
+
+    while (context->literals > 0) {
+        output_block(context);
+    }
+
+    // an odd sized uncompressed block that ends the stream owes a pad byte to the next frame.
+    if (pad != NULL) {
+        *pad = (context->input_running_total == 0 && context->output_buffer_curpos != context->output_buffer_start);
+    }
+
+    encode_flush(context);
+
+    if (context->output_error != 0) {
+        result = context->output_error;
+        goto Cleanup;
+    }
+
+    if (context->output_overflow) {
+        result = LZX_ERROR_BUFFER_OVERFLOW;
+        goto Cleanup;
+    }
+
+    *output_size = context->output_buffer_size;
+
+Cleanup:
+
+    // the buffer may have moved if it grew
+    *dest = context->output_buffer_base;
+    *capacity = context->output_buffer_capacity;
+
+    return result;
+}
+static int compress_ultra(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t offset, uint32_t size, uint8_t** dest, uint32_t* capacity, bool grow, uint32_t* output_size, bool* pad) {
+    // compress the stream repeatedly, pricing each pass with the trees the previous pass
+    // built, and keep the smallest output. the match finder can not rewind, so a pass
+    // covers the whole stream rather than a single block.
+
+    LZX_PASS_COST* swap_costs = NULL;
+    uint32_t swap_capacity = 0;
+    uint8_t* output = NULL;
+    uint8_t* best = NULL;
+    uint8_t* new_dest = NULL;
+    uint32_t output_capacity = 0;
+    uint32_t pass_size = 0;
+    uint32_t best_size = 0;
+    bool pass_pad = false;
+    bool best_pad = false;
+    int pass;
+    int result = 0;
+
+    context->pass_cost_count = 0;
+    context->pass_recording = true;
+
+    for (pass = 0; pass < ULTRA_MAX_PASSES; pass++) {
+        output_capacity = lzx_compress_bound(size) + sizeof(LZX_BLOCK) + LZX_OUTPUT_SIZE;
+        output = (uint8_t*)malloc(output_capacity);
+        if (output == NULL) {
+            result = LZX_ERROR_OUT_OF_MEMORY;
+            goto Cleanup;
+        }
+
+        result = compress_stream(context, src, offset, size, &output, &output_capacity, false, &pass_size, &pass_pad);
+        if (result != 0) {
+            goto Cleanup;
+        }
+
+        if (best != NULL && pass_size >= best_size) {
+            break;
+        }
+
+        if (best != NULL) {
+            free(best);
+        }
+        best = output;
+        best_size = pass_size;
+        best_pad = pass_pad;
+        output = NULL;
+
+        // the trees this pass built price the next one.
+        swap_costs = context->pass_costs;
+        swap_capacity = context->pass_cost_capacity;
+        context->pass_costs = context->pass_record;
+        context->pass_cost_capacity = context->pass_record_capacity;
+        context->pass_cost_count = context->pass_record_count;
+        context->pass_record = swap_costs;
+        context->pass_record_capacity = swap_capacity;
+        context->pass_record_count = 0;
+    }
+
+    if (*capacity != 0 && best_size > *capacity) {
+        if (!grow) {
+            result = LZX_ERROR_BUFFER_OVERFLOW;
+            goto Cleanup;
+        }
+        new_dest = (uint8_t*)realloc(*dest, best_size);
+        if (new_dest == NULL) {
             result = LZX_ERROR_OUT_OF_MEMORY;
             goto Cleanup;
         }
+        *dest = new_dest;
+        *capacity = best_size;
     }
 
+    memcpy(*dest, best, best_size);
+    *output_size = best_size;
+    if (pad != NULL) {
+        *pad = best_pad;
+    }
+
+Cleanup:
+
+    if (output != NULL) {
+        free(output);
+        output = NULL;
+    }
+
+    if (best != NULL) {
+        free(best);
+        best = NULL;
+    }
+
+    context->pass_cost_count = 0;
+    context->pass_recording = false;
+
+    return result;
+}
+
+int lzx_compress_ctx(ENCODER_CONTEXT* context, const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size) {
+    uint32_t capacity = 0;
+    uint32_t output_size = 0;
+    bool grow = false;
+    int result = 0;
+
+    if (dest_size != NULL) {
+        capacity = *dest_size;
+    }
+
+    // Allocate a buffer if one was not provided; start at about half the input and grow as needed
+    if (*dest == NULL) {
+        capacity = min(src_size / 2 + (uint32_t)(sizeof(LZX_BLOCK) + LZX_OUTPUT_SIZE), lzx_compress_bound(src_size));
+        if (capacity == 0) {
+            capacity = sizeof(LZX_BLOCK) + LZX_OUTPUT_SIZE;
+        }
+        *dest = (uint8_t*)malloc(capacity);
+        if (*dest == NULL) {
+            return LZX_ERROR_OUT_OF_MEMORY;
+        }
+        grow = true;
+    }
+
+    if (context->level >= LZX_LEVEL_ULTRA) {
+        result = compress_ultra(context, src, 0, src_size, dest, &capacity, grow, &output_size, NULL);
+    }
+    else {
+        result = compress_stream(context, src, 0, src_size, dest, &capacity, grow, &output_size, NULL);
+    }
+
+    if (result == 0 && compressed_size != NULL) {
+        *compressed_size = output_size;
+    }
+
+    if (dest_size != NULL && grow) {
+        *dest_size = capacity;
+    }
+
+    return result;
+}
+
+int lzx_compress(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params) {
+    ENCODER_CONTEXT* context = NULL;
+    int result = 0;
+
     // Create the compression context
-    context = lzx_create_compression(*dest);
+    context = lzx_create_compression(NULL, params);
     if (context == NULL) {
         result = LZX_ERROR_OUT_OF_MEMORY;
         goto Cleanup;
     }
 
-    bytes_remaining = src_size;
-    src_ptr = src;
+    result = lzx_compress_ctx(context, src, src_size, dest, dest_size, compressed_size);
+
+Cleanup:
     
-    lzx_flush_compression(context);
+    if (context != NULL) {
+        lzx_destroy_compression(context);
+        context = NULL;
+    }
+
+    return result;
+}
+
+int lzx_compress_fd(int in_fd, int out_fd, const LZX_COMPRESSION_PARAMS* params, uint32_t* src_size, uint32_t* compressed_size) {
+    ENCODER_CONTEXT* context = NULL;
+    uint32_t total_read = 0;
+    int bytes_read = 0;
+    int result = 0;
+
+    // Create the compression context; frames go straight to the output fd
+    context = lzx_create_compression(NULL, params);
+    if (context == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    context->output_fd = out_fd;
 
     for (;;) {
-        if ((uint32_t)(src_ptr - src) >= src_size) {
-            result = 0;
-			break;
-		}
+        // read the next chunk straight into the encoders input buffer
+        bytes_read = readFd(in_fd, context->input_buffer, LZX_CHUNK_SIZE);
+        if (bytes_read < 0) {
+            result = LZX_ERROR_IO;
+            goto Cleanup;
+        }
+
+        if (bytes_read == 0) {
+            break;
+        }
 
-        bytes_read = min(LZX_CHUNK_SIZE, bytes_remaining);
+        total_read += bytes_read;
 
-        result = lzx_compress_next_block(context, &src_ptr, bytes_read, &bytes_remaining);
+        result = encode_data(context, bytes_read);
         if (result != 0) {
             goto Cleanup;
         }
+
+        if (bytes_read < LZX_CHUNK_SIZE) {
+            break;
+        }
     }
 
     lzx_flush_compression(context);
+    if (context->output_error != 0) {
+        result = context->output_error;
+        goto Cleanup;
+    }
 
-    total_compressed_size = context->output_buffer_size;
+    if (src_size != NULL) {
+        *src_size = total_read;
+    }
 
     if (compressed_size != NULL) {
-        *compressed_size = total_compressed_size;
+        *compressed_size = context->output_buffer_size;
     }
 
 Cleanup:
-    
+
+    if (context != NULL) {
+        lzx_destroy_compression(context);
+        context = NULL;
+    }
+
+    return result;
+}
+
+static void encode_empty_tree(ENCODER_CONTEXT* context, int num) {
+    // write a tree of zero lengths using only the zero run codes; these
+    // dont depend on the previous tree, so the decoder state is known afterwards.
+    int run;
+
+    for (int i = 0; i < NUM_PRETREE_ELEMENTS; i++) {
+        output_bits(context, 4, (i == 17 || i == 18) ? 1 : 0);
+    }
+
+    while (num > 0) {
+        run = num;
+        if (run > TREE_ENC_REP_MIN + TREE_ENC_REP_ZERO_FIRST + TREE_ENC_REP_ZERO_SECOND - 1) {
+            run = TREE_ENC_REP_MIN + TREE_ENC_REP_ZERO_FIRST + TREE_ENC_REP_ZERO_SECOND - 1;
+            if (num - run < TREE_ENC_REP_MIN)
+                run = num - TREE_ENC_REP_MIN;
+        }
+
+        if (run < TREE_ENC_REP_MIN + TREE_ENC_REP_ZERO_FIRST) {
+            output_bits(context, 1, 0);
+            output_bits(context, TREE_ENC_REPZ_FIRST_EXTRA_BITS, run - TREE_ENC_REP_MIN);
+        }
+        else {
+            output_bits(context, 1, 1);
+            output_bits(context, TREE_ENC_REPZ_SECOND_EXTRA_BITS, run - (TREE_ENC_REP_MIN + TREE_ENC_REP_ZERO_FIRST));
+        }
+
+        num -= run;
+    }
+}
+static void encode_segment_start(ENCODER_CONTEXT* context) {
+    // a segment is encoded without knowing how the previous segment left the decoder.
+    // write an empty uncompressed block to load the repeated offsets and an empty
+    // verbatim block with zeroed trees to reset the previous tree lengths.
+
+    output_bits(context, 3, LZX_BLOCK_TYPE_UNCOMPRESSED);
+    output_bits(context, 8, 0);
+    output_bits(context, 8, 0);
+    output_bits(context, 8, 0);
+    encode_uncompressed_block(context, context->bufpos, 0);
+
+    output_bits(context, 3, LZX_BLOCK_TYPE_VERBATIM);
+    output_bits(context, 8, 0);
+    output_bits(context, 8, 0);
+    output_bits(context, 8, 0);
+    encode_empty_tree(context, NUM_CHARS);
+    encode_empty_tree(context, context->num_position_slots * (LZX_NUM_PRIMARY_LEN + 1));
+    encode_empty_tree(context, LZX_NUM_SECONDARY_LEN);
+}
+static void prime_compression(ENCODER_CONTEXT* context, const uint8_t* src, uint32_t offset, uint32_t size) {
+    // load the window with the plaintext preceding a segment. src is the start of the input,
+    // offset is the segment offset. size must be a multiple of the chunk size.
+
+    uint32_t buf_pos = context->bufpos;
+    uint32_t i;
+
+    context->file_size_for_translation = context->e8_translation ? DEFAULT_FILE_XLAT_SIZE : 0;
+    context->instr_pos = offset - size;
+    context->cfdata_frames = (offset - size) / LZX_CHUNK_SIZE;
+
+    for (i = 0; i < size; i += LZX_CHUNK_SIZE) {
+        memcpy(context->input_buffer, src + (offset - size) + i, LZX_CHUNK_SIZE);
+        context->input_ptr = context->input_buffer;
+        context->input_left = LZX_CHUNK_SIZE;
+        read_input(context, buf_pos + i - (uint32_t)(context->real_mem_window - context->mem_window), LZX_CHUNK_SIZE);
+    }
+
+    // the last few positions are inserted by opt_encode_top once the segment data is loaded.
+    for (i = 0; i < size - BREAK_LENGTH; i++) {
+        context->insert_node(context, buf_pos + i, buf_pos + i - context->window_size + 4);
+    }
+
+    context->bufpos = buf_pos + size;
+    context->bufpos_last_output_block = context->bufpos;
+    context->bufpos_at_last_block = context->bufpos;
+    context->earliest_window_data_remaining = context->bufpos - context->window_size;
+    context->next_tree_create = 10000;
+    context->first_time_this_group = false;
+
+    // redo_first_block() clears the search trees, which would drop the primed history.
+    context->first_block = false;
+}
+static void compress_segment(void* arg) {
+    LZX_SEGMENT* segment = (LZX_SEGMENT*)arg;
+    ENCODER_CONTEXT* context = NULL;
+    uint32_t capacity = segment->output_capacity;
+    int result = 0;
+
+    context = lzx_create_compression(segment->output, segment->params);
+    if (context == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    if (context->level >= LZX_LEVEL_ULTRA) {
+        result = compress_ultra(context, segment->src, segment->offset, segment->size, &segment->output, &capacity, false, &segment->output_size, &segment->pad);
+    }
+    else {
+        result = compress_stream(context, segment->src, segment->offset, segment->size, &segment->output, &capacity, false, &segment->output_size, &segment->pad);
+    }
+
+Cleanup:
+
     if (context != NULL) {
         lzx_destroy_compression(context);
         context = NULL;
     }
 
+    segment->result = result;
+}
+
+static int stitch_segments(LZX_SEGMENT* segments, uint32_t segment_count, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size) {
+    // join the segment frames into a single stream; dest is allocated if it is null.
+    // the segment outputs are left as they are.
+
+    LZX_BLOCK block;
+    uint8_t* dest_ptr = NULL;
+    uint32_t total_compressed_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < segment_count; i++) {
+        if (segments[i].result != 0) {
+            return segments[i].result;
+        }
+        total_compressed_size += segments[i].output_size;
+        if (i > 0 && segments[i - 1].pad) {
+            total_compressed_size++;
+        }
+    }
+
+    // Allocate a buffer if one was not provided
+    if (*dest == NULL) {
+        *dest = (uint8_t*)malloc(total_compressed_size);
+        if (*dest == NULL) {
+            return LZX_ERROR_OUT_OF_MEMORY;
+        }
+        if (dest_size != NULL) {
+            *dest_size = total_compressed_size;
+        }
+    }
+    else if (dest_size != NULL && *dest_size < total_compressed_size) {
+        return LZX_ERROR_BUFFER_OVERFLOW;
+    }
+
+    // stitch the segment frames together
+    dest_ptr = *dest;
+    for (i = 0; i < segment_count; i++) {
+        if (i > 0 && segments[i - 1].pad) {
+            memcpy(&block, segments[i].output, sizeof(LZX_BLOCK));
+            block.compressed_size++;
+            memcpy(dest_ptr, &block, sizeof(LZX_BLOCK));
+            dest_ptr += sizeof(LZX_BLOCK);
+            *dest_ptr++ = 0;
+            memcpy(dest_ptr, segments[i].output + sizeof(LZX_BLOCK), segments[i].output_size - sizeof(LZX_BLOCK));
+            dest_ptr += segments[i].output_size - sizeof(LZX_BLOCK);
+        }
+        else {
+            memcpy(dest_ptr, segments[i].output, segments[i].output_size);
+            dest_ptr += segments[i].output_size;
+        }
+    }
+
+    if (compressed_size != NULL) {
+        *compressed_size = total_compressed_size;
+    }
+
+    return 0;
+}
+
+int lzx_compress_mt(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* dest_size, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params, uint32_t threads) {
+    LZX_SEGMENT* segments = NULL;
+    THREAD* thread_handles = NULL;
+    uint32_t segment_count = 0;
+    uint32_t segment_size = 0;
+    uint32_t i;
+    int result = 0;
+
+    if (threads == 0) {
+        threads = thread_get_cpu_count();
+    }
+    if (threads > THREAD_MAX_COUNT) {
+        threads = THREAD_MAX_COUNT;
+    }
+
+    // segments are a multiple of the chunk size so segment boundaries land on frame boundaries.
+    segment_size = (src_size + threads - 1) / threads;
+    if (segment_size < MT_MIN_SEGMENT_SIZE) {
+        segment_size = MT_MIN_SEGMENT_SIZE;
+    }
+    segment_size = (segment_size + LZX_CHUNK_SIZE - 1) & ~(LZX_CHUNK_SIZE - 1);
+    segment_count = (src_size + segment_size - 1) / segment_size;
+
+    if (threads <= 1 || segment_count <= 1) {
+        return lzx_compress(src, src_size, dest, dest_size, compressed_size, params);
+    }
+
+    segments = (LZX_SEGMENT*)malloc(sizeof(LZX_SEGMENT) * segment_count);
+    thread_handles = (THREAD*)malloc(sizeof(THREAD) * segment_count);
+    if (segments == NULL || thread_handles == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+    memset(segments, 0, sizeof(LZX_SEGMENT) * segment_count);
+    memset(thread_handles, 0, sizeof(THREAD) * segment_count);
+
+    for (i = 0; i < segment_count; i++) {
+        segments[i].src = src;
+        segments[i].params = params;
+        segments[i].offset = i * segment_size;
+        segments[i].size = min(segment_size, src_size - segments[i].offset);
+        segments[i].result = LZX_ERROR_FAILED;
+
+        // worst case; every frame is the largest frame the encoder can emit.
+        segments[i].output_capacity = lzx_compress_bound(segments[i].size);
+        segments[i].output = (uint8_t*)malloc(segments[i].output_capacity);
+        if (segments[i].output == NULL) {
+            result = LZX_ERROR_OUT_OF_MEMORY;
+            goto Cleanup;
+        }
+    }
+
+    for (i = 0; i < segment_count; i++) {
+        if (thread_start(&thread_handles[i], compress_segment, &segments[i]) != 0) {
+            // compress on this thread instead.
+            compress_segment(&segments[i]);
+        }
+    }
+
+    for (i = 0; i < segment_count; i++) {
+        thread_join(&thread_handles[i]);
+    }
+
+    result = stitch_segments(segments, segment_count, dest, dest_size, compressed_size);
+
+Cleanup:
+
+    if (segments != NULL) {
+        for (i = 0; i < segment_count; i++) {
+            if (segments[i].output != NULL) {
+                free(segments[i].output);
+                segments[i].output = NULL;
+            }
+        }
+        free(segments);
+        segments = NULL;
+    }
+
+    if (thread_handles != NULL) {
+        free(thread_handles);
+        thread_handles = NULL;
+    }
+
+    return result;
+}
+
+static bool compression_params_equal(const LZX_COMPRESSION_PARAMS* a, const LZX_COMPRESSION_PARAMS* b) {
+    return a->match_finder == b->match_finder && a->level == b->level
+        && a->max_block_splits == b->max_block_splits && a->split_min_gain == b->split_min_gain
+        && a->e8_translation == b->e8_translation;
+}
+static void compress_candidate(void* arg) {
+    LZX_FIT_CANDIDATE* candidate = (LZX_FIT_CANDIDATE*)arg;
+    candidate->result = lzx_compress(candidate->src, candidate->src_size, &candidate->output, NULL, &candidate->output_size, &candidate->params);
+}
+
+int lzx_compress_fit(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params, uint32_t target_size, uint32_t threads) {
+    LZX_FIT_CANDIDATE* candidates = NULL;
+    THREAD* thread_handles = NULL;
+    LZX_COMPRESSION_PARAMS base;
+    uint32_t candidate_count = 0;
+    uint32_t batch_start = 0;
+    uint32_t batch_end = 0;
+    uint32_t best = 0;
+    uint32_t i, j;
+    int result = 0;
+
+    if (threads == 0) {
+        threads = thread_get_cpu_count();
+    }
+    if (threads > THREAD_MAX_COUNT) {
+        threads = THREAD_MAX_COUNT;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    if (params != NULL) {
+        base = *params;
+    }
+    else {
+        lzx_init_compression_params(&base);
+    }
+
+    candidates = (LZX_FIT_CANDIDATE*)malloc(sizeof(LZX_FIT_CANDIDATE) * (1 + sizeof(fit_variants) / sizeof(fit_variants[0])));
+    thread_handles = (THREAD*)malloc(sizeof(THREAD) * threads);
+    if (candidates == NULL || thread_handles == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    // the base parameters first, then each variant that differs from every earlier candidate.
+    memset(&candidates[0], 0, sizeof(LZX_FIT_CANDIDATE));
+    candidates[0].params = base;
+    candidate_count = 1;
+
+    for (i = 0; i < sizeof(fit_variants) / sizeof(fit_variants[0]); i++) {
+        LZX_FIT_CANDIDATE* candidate = &candidates[candidate_count];
+        memset(candidate, 0, sizeof(LZX_FIT_CANDIDATE));
+        candidate->params = base;
+        candidate->params.max_block_splits = fit_variants[i].max_block_splits;
+        candidate->params.split_min_gain = fit_variants[i].split_min_gain;
+        candidate->params.e8_translation = fit_variants[i].e8_translation;
+        if (fit_variants[i].level != 0) {
+            candidate->params.level = fit_variants[i].level;
+        }
+
+        for (j = 0; j < candidate_count; j++) {
+            if (compression_params_equal(&candidates[j].params, &candidate->params))
+                break;
+        }
+        if (j == candidate_count) {
+            candidate_count++;
+        }
+    }
+
+    for (i = 0; i < candidate_count; i++) {
+        candidates[i].src = src;
+        candidates[i].src_size = src_size;
+        candidates[i].result = LZX_ERROR_FAILED;
+    }
+
+    best = candidate_count;
+
+    for (batch_start = 0; batch_start < candidate_count; batch_start = batch_end) {
+        batch_end = min(batch_start + threads, candidate_count);
+
+        memset(thread_handles, 0, sizeof(THREAD) * threads);
+        for (i = batch_start; i < batch_end; i++) {
+            if (thread_start(&thread_handles[i - batch_start], compress_candidate, &candidates[i]) != 0) {
+                // compress on this thread instead.
+                compress_candidate(&candidates[i]);
+            }
+        }
+
+        for (i = batch_start; i < batch_end; i++) {
+            thread_join(&thread_handles[i - batch_start]);
+        }
+
+        for (i = batch_start; i < batch_end; i++) {
+            if (candidates[i].result != 0) {
+                result = candidates[i].result;
+                goto Cleanup;
+            }
+            if (best == candidate_count || candidates[i].output_size < candidates[best].output_size) {
+                best = i;
+            }
+        }
+
+        if (target_size != 0 && candidates[best].output_size <= target_size) {
+            break;
+        }
+    }
+
+    *dest = candidates[best].output;
+    candidates[best].output = NULL;
+
+    if (compressed_size != NULL) {
+        *compressed_size = candidates[best].output_size;
+    }
+
+    if (target_size != 0 && candidates[best].output_size > target_size) {
+        result = LZX_ERROR_BUFFER_OVERFLOW;
+    }
+
+Cleanup:
+
+    if (candidates != NULL) {
+        for (i = 0; i < candidate_count; i++) {
+            if (candidates[i].output != NULL) {
+                free(candidates[i].output);
+                candidates[i].output = NULL;
+            }
+        }
+        free(candidates);
+        candidates = NULL;
+    }
+
+    if (thread_handles != NULL) {
+        free(thread_handles);
+        thread_handles = NULL;
+    }
+
+    return result;
+}
+
+static bool checkpoint_usable(const LZX_CHECKPOINT_HEADER* header, const uint8_t* checkpoint, uint32_t checkpoint_size) {
+    // a checkpoint is only usable if it was made with the same parameters and is complete.
+
+    const LZX_CHECKPOINT_HEADER* old_header = (const LZX_CHECKPOINT_HEADER*)checkpoint;
+    const LZX_CHECKPOINT_SEGMENT* old_records = NULL;
+    uint64_t size = 0;
+    uint32_t i;
+
+    if (checkpoint == NULL || checkpoint_size < sizeof(LZX_CHECKPOINT_HEADER))
+        return false;
+
+    if (old_header->magic != header->magic || old_header->version != header->version || old_header->segment_size != header->segment_size
+        || old_header->match_finder != header->match_finder || old_header->level != header->level
+        || old_header->max_block_splits != header->max_block_splits || old_header->split_min_gain != header->split_min_gain
+        || old_header->e8_translation != header->e8_translation)
+        return false;
+
+    size = sizeof(LZX_CHECKPOINT_HEADER) + (uint64_t)old_header->segment_count * sizeof(LZX_CHECKPOINT_SEGMENT);
+    if (size > checkpoint_size)
+        return false;
+
+    old_records = (const LZX_CHECKPOINT_SEGMENT*)(checkpoint + sizeof(LZX_CHECKPOINT_HEADER));
+    for (i = 0; i < old_header->segment_count; i++) {
+        size += old_records[i].output_size;
+    }
+
+    return size <= checkpoint_size;
+}
+
+int lzx_compress_incremental(const uint8_t* src, const uint32_t src_size, uint8_t** dest, uint32_t* compressed_size, const LZX_COMPRESSION_PARAMS* params,
+    const uint8_t* checkpoint, const uint32_t checkpoint_size, uint8_t** new_checkpoint, uint32_t* new_checkpoint_size, uint32_t* reused_size, uint32_t threads) {
+    LZX_CHECKPOINT_HEADER header;
+    LZX_CHECKPOINT_SEGMENT* records = NULL;
+    const LZX_CHECKPOINT_SEGMENT* old_records = NULL;
+    const uint8_t* old_output = NULL;
+    LZX_SEGMENT* segments = NULL;
+    THREAD* thread_handles = NULL;
+    uint32_t* pending = NULL;
+    uint8_t* checkpoint_ptr = NULL;
+    LZX_COMPRESSION_PARAMS base;
+    SHA1Context sha;
+    uint32_t old_count = 0;
+    uint32_t segment_count = 0;
+    uint32_t pending_count = 0;
+    uint32_t prime_size = 0;
+    uint32_t total_output_size = 0;
+    uint32_t reused = 0;
+    uint32_t batch_start = 0;
+    uint32_t batch_end = 0;
+    uint32_t i;
+    int result = 0;
+
+    if (threads == 0) {
+        threads = thread_get_cpu_count();
+    }
+    if (threads > THREAD_MAX_COUNT) {
+        threads = THREAD_MAX_COUNT;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    if (params != NULL) {
+        base = *params;
+    }
+    else {
+        lzx_init_compression_params(&base);
+    }
+
+    // the input is compressed as primed segments on fixed boundaries, the same way lzx_compress_mt()
+    // does, so a segment's output depends only on its data and the window before it.
+    segment_count = (src_size + CHECKPOINT_SEGMENT_SIZE - 1) / CHECKPOINT_SEGMENT_SIZE;
+
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.src_size = src_size;
+    header.segment_size = CHECKPOINT_SEGMENT_SIZE;
+    header.segment_count = segment_count;
+    header.match_finder = base.match_finder;
+    header.level = base.level;
+    header.max_block_splits = base.max_block_splits;
+    header.split_min_gain = base.split_min_gain;
+    header.e8_translation = base.e8_translation;
+
+    if (checkpoint_usable(&header, checkpoint, checkpoint_size)) {
+        old_count = ((const LZX_CHECKPOINT_HEADER*)checkpoint)->segment_count;
+        old_records = (const LZX_CHECKPOINT_SEGMENT*)(checkpoint + sizeof(LZX_CHECKPOINT_HEADER));
+        old_output = (const uint8_t*)(old_records + old_count);
+    }
+
+    segments = (LZX_SEGMENT*)malloc(sizeof(LZX_SEGMENT) * (segment_count + 1));
+    records = (LZX_CHECKPOINT_SEGMENT*)malloc(sizeof(LZX_CHECKPOINT_SEGMENT) * (segment_count + 1));
+    pending = (uint32_t*)malloc(sizeof(uint32_t) * (segment_count + 1));
+    thread_handles = (THREAD*)malloc(sizeof(THREAD) * threads);
+    if (segments == NULL || records == NULL || pending == NULL || thread_handles == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+    memset(segments, 0, sizeof(LZX_SEGMENT) * segment_count);
+
+    for (i = 0; i < segment_count; i++) {
+        segments[i].src = src;
+        segments[i].params = &base;
+        segments[i].offset = i * CHECKPOINT_SEGMENT_SIZE;
+        segments[i].size = min(CHECKPOINT_SEGMENT_SIZE, src_size - segments[i].offset);
+
+        prime_size = min(segments[i].offset, LZX_WINDOW_SIZE);
+        SHA1Reset(&sha);
+        SHA1Input(&sha, src + segments[i].offset - prime_size, prime_size + segments[i].size);
+        SHA1Result(&sha, records[i].digest);
+
+        if (i < old_count && memcmp(records[i].digest, old_records[i].digest, SHA1_DIGEST_LEN) == 0) {
+            // unchanged; reuse the frames from the checkpoint.
+            segments[i].output = (uint8_t*)malloc(old_records[i].output_size);
+            if (segments[i].output == NULL) {
+                result = LZX_ERROR_OUT_OF_MEMORY;
+                goto Cleanup;
+            }
+            memcpy(segments[i].output, old_output, old_records[i].output_size);
+            segments[i].output_size = old_records[i].output_size;
+            segments[i].pad = (old_records[i].pad != 0);
+            segments[i].result = 0;
+            reused += segments[i].size;
+        }
+        else {
+            segments[i].result = LZX_ERROR_FAILED;
+            segments[i].output_capacity = lzx_compress_bound(segments[i].size);
+            segments[i].output = (uint8_t*)malloc(segments[i].output_capacity);
+            if (segments[i].output == NULL) {
+                result = LZX_ERROR_OUT_OF_MEMORY;
+                goto Cleanup;
+            }
+            pending[pending_count++] = i;
+        }
+
+        if (i < old_count) {
+            old_output += old_records[i].output_size;
+        }
+    }
+
+    for (batch_start = 0; batch_start < pending_count; batch_start = batch_end) {
+        batch_end = min(batch_start + threads, pending_count);
+
+        memset(thread_handles, 0, sizeof(THREAD) * threads);
+        for (i = batch_start; i < batch_end; i++) {
+            if (thread_start(&thread_handles[i - batch_start], compress_segment, &segments[pending[i]]) != 0) {
+                // compress on this thread instead.
+                compress_segment(&segments[pending[i]]);
+            }
+        }
+
+        for (i = batch_start; i < batch_end; i++) {
+            thread_join(&thread_handles[i - batch_start]);
+        }
+    }
+
+    result = stitch_segments(segments, segment_count, dest, NULL, compressed_size);
+    if (result != 0) {
+        goto Cleanup;
+    }
+
+    // write the new checkpoint
+    for (i = 0; i < segment_count; i++) {
+        records[i].output_size = segments[i].output_size;
+        records[i].pad = segments[i].pad;
+        total_output_size += segments[i].output_size;
+    }
+
+    *new_checkpoint_size = sizeof(LZX_CHECKPOINT_HEADER) + sizeof(LZX_CHECKPOINT_SEGMENT) * segment_count + total_output_size;
+    *new_checkpoint = (uint8_t*)malloc(*new_checkpoint_size);
+    if (*new_checkpoint == NULL) {
+        result = LZX_ERROR_OUT_OF_MEMORY;
+        goto Cleanup;
+    }
+
+    checkpoint_ptr = *new_checkpoint;
+    memcpy(checkpoint_ptr, &header, sizeof(LZX_CHECKPOINT_HEADER));
+    checkpoint_ptr += sizeof(LZX_CHECKPOINT_HEADER);
+    memcpy(checkpoint_ptr, records, sizeof(LZX_CHECKPOINT_SEGMENT) * segment_count);
+    checkpoint_ptr += sizeof(LZX_CHECKPOINT_SEGMENT) * segment_count;
+    for (i = 0; i < segment_count; i++) {
+        memcpy(checkpoint_ptr, segments[i].output, segments[i].output_size);
+        checkpoint_ptr += segments[i].output_size;
+    }
+
+    if (reused_size != NULL) {
+        *reused_size = reused;
+    }
+
+Cleanup:
+
+    if (segments != NULL) {
+        for (i = 0; i < segment_count; i++) {
+            if (segments[i].output != NULL) {
+                free(segments[i].output);
+                segments[i].output = NULL;
+            }
+        }
+        free(segments);
+        segments = NULL;
+    }
+
+    if (records != NULL) {
+        free(records);
+        records = NULL;
+    }
+
+    if (pending != NULL) {
+        free(pending);
+        pending = NULL;
+    }
+
+    if (thread_handles != NULL) {
+        free(thread_handles);
+        thread_handles = NULL;
+    }
+
     return result;
 }
@@ -0,0 +1,216 @@
+// lzx_match.c: match length kernels for the lzx match finders
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+// std incl
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LZX_MATCH_X86
+#include <immintrin.h>
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// user incl
+#include "lzx_match.h"
+
+#ifdef MEM_TRACKING
+#include "mem_tracking.h"
+#endif
+
+#if defined(LZX_MATCH_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+static inline int ctz32(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline int ctz64(uint64_t x) {
+#if defined(_MSC_VER) && !defined(_M_X64) && !defined(_M_ARM64)
+    if ((uint32_t)x != 0)
+        return ctz32((uint32_t)x);
+    return 32 + ctz32((uint32_t)(x >> 32));
+#elif defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+static inline int is_little_endian() {
+    const uint16_t x = 1;
+    return *(const uint8_t*)&x == 1;
+}
+
+int lzx_match_len_byte(const uint8_t* a, const uint8_t* b, int len, int limit) {
+    while (len < limit && a[len] == b[len]) {
+        len++;
+    }
+    return len;
+}
+
+int lzx_match_len_word(const uint8_t* a, const uint8_t* b, int len, int limit) {
+    uint64_t x, y;
+
+    while (len + 8 <= limit) {
+        memcpy(&x, a + len, sizeof(x));
+        memcpy(&y, b + len, sizeof(y));
+        if (x != y) {
+            return len + (ctz64(x ^ y) >> 3);
+        }
+        len += 8;
+    }
+
+    return lzx_match_len_byte(a, b, len, limit);
+}
+
+#ifdef LZX_MATCH_X86
+
+TARGET_SSE2 static int lzx_match_len_sse2(const uint8_t* a, const uint8_t* b, int len, int limit) {
+    __m128i x, y;
+    uint32_t mask;
+
+    while (len + 16 <= limit) {
+        x = _mm_loadu_si128((const __m128i*)(a + len));
+        y = _mm_loadu_si128((const __m128i*)(b + len));
+        mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+        if (mask != 0) {
+            return len + ctz32(mask);
+        }
+        len += 16;
+    }
+
+    return lzx_match_len_word(a, b, len, limit);
+}
+
+TARGET_AVX2 static int lzx_match_len_avx2(const uint8_t* a, const uint8_t* b, int len, int limit) {
+    __m256i x, y;
+    uint32_t mask;
+
+    while (len + 32 <= limit) {
+        x = _mm256_loadu_si256((const __m256i*)(a + len));
+        y = _mm256_loadu_si256((const __m256i*)(b + len));
+        mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask != 0) {
+            return len + ctz32(mask);
+        }
+        len += 32;
+    }
+
+    return lzx_match_len_sse2(a, b, len, limit);
+}
+
+int lzx_cpu_has_avx2() {
+    uint32_t regs[4];
+
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 0);
+    if (regs[0] < 7)
+        return 0;
+    __cpuid((int*)regs, 1);
+#else
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+    // osxsave and avx
+    if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+        return 0;
+
+    // os saves the ymm state
+#ifdef _MSC_VER
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex((int*)regs, 7, 0);
+#else
+    {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 6) != 6)
+            return 0;
+    }
+    __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+    return (regs[1] & (1 << 5)) != 0;
+}
+
+int lzx_cpu_has_sse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+    return 1;
+#else
+    uint32_t regs[4];
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 1);
+#else
+    if (__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]) == 0)
+        return 0;
+#endif
+    return (regs[3] & (1 << 26)) != 0;
+#endif
+}
+
+#else
+
+int lzx_cpu_has_avx2() {
+    return 0;
+}
+
+int lzx_cpu_has_sse2() {
+    return 0;
+}
+
+#endif // LZX_MATCH_X86
+
+LZX_MATCH_LEN_PROC lzx_get_match_len_proc() {
+#ifdef LZX_MATCH_X86
+    if (lzx_cpu_has_avx2())
+        return lzx_match_len_avx2;
+    if (lzx_cpu_has_sse2())
+        return lzx_match_len_sse2;
+#endif
+
+    // the word kernel counts trailing zeros, so it needs the first byte in the low bits.
+    if (is_little_endian())
+        return lzx_match_len_word;
+
+    return lzx_match_len_byte;
+}
@@ -21,10 +21,16 @@
 #include <malloc.h>
 #include <stdio.h>
 
+#ifndef _WIN32
+// usable size; may be larger than requested, so it is also used when counting the allocation
+#define _msize malloc_usable_size
+#endif
+
 //#define MEM_TRACKING_PRINT
 
 long memtrack_allocatedBytes = 0;
 int memtrack_allocations = 0;
+long memtrack_totalAllocations = 0;
 
 void* memtrack_malloc(size_t size)
 {
@@ -37,7 +43,8 @@ void* memtrack_malloc(size_t size)
 	}
 
 	memtrack_allocations++;
-	memtrack_allocatedBytes += size;
+	memtrack_totalAllocations++;
+	memtrack_allocatedBytes += _msize(ptr);
 
 #ifdef MEM_TRACKING_PRINT
 	printf("allocated %d bytes\n", size);
@@ -75,6 +82,9 @@ void memtrack_free(void* ptr)
 
 void* memtrack_realloc(void* ptr, size_t size)
 {
+	if (ptr == NULL)
+		return memtrack_malloc(size);
+
 	size_t oldSize = _msize(ptr);
 	void* newPtr = realloc(ptr, size);
 
@@ -85,8 +95,9 @@ void* memtrack_realloc(void* ptr, size_t size)
 		return NULL;
 	}
 
+	memtrack_totalAllocations++;
 	memtrack_allocatedBytes -= oldSize;
-	memtrack_allocatedBytes += size;
+	memtrack_allocatedBytes += _msize(newPtr);
 
 #ifdef MEM_TRACKING_PRINT
 	printf("reallocated %u -> %u ( %d bytes )\n", oldSize, size, (size - oldSize));
@@ -109,10 +120,11 @@ void* memtrack_calloc(size_t count, size_t size)
 	}
 
 	memtrack_allocations++;
-	memtrack_allocatedBytes += size;
+	memtrack_totalAllocations++;
+	memtrack_allocatedBytes += _msize(ptr);
 
 #ifdef MEM_TRACKING_PRINT
-	printf("allocated %d bytes.\n", size);
+	printf("allocated %d bytes.\n", count * size);
 #endif
 
 	return ptr;
@@ -20,6 +20,8 @@
 // GitHub: https:\\github.com\tommojphillips
 
 #include <stdint.h>
+#include <string.h>
+
 #include "rc4.h"
 
 void swap_byte(uint8_t* a, uint8_t* b);
@@ -45,14 +47,49 @@ void rc4_key(RC4_CONTEXT* context, const uint8_t* key, const size_t len) {
 }
 
 void rc4(RC4_CONTEXT* c, uint8_t* data, const size_t size) {
+    if (data == NULL) {
+        rc4_skip(c, size);
+        return;
+    }
+
+    // keep the state in locals; stores through data could alias the context.
+    uint8_t* s = c->s;
+    uint8_t k = c->k;
+    uint8_t j = c->j;
+    uint8_t t = c->t;
     for (size_t i = 0; i < size; ++i) {
-        c->k = c->k + 1;
-        c->j = c->j + c->s[c->k];
-        swap_byte(&c->s[c->k], &c->s[c->j]);
-        c->t = c->s[c->k] + c->s[c->j];
-        if (data != NULL)
-            data[i] ^= c->s[c->t];
+        k++;
+        uint8_t sk = s[k];
+        j += sk;
+        uint8_t sj = s[j];
+        s[k] = sj;
+        s[j] = sk;
+        t = sk + sj;
+        data[i] ^= s[t];
     }
+    c->k = k;
+    c->j = j;
+    c->t = t;
+}
+
+void rc4_skip(RC4_CONTEXT* c, const size_t size) {
+    uint8_t* s = c->s;
+    uint8_t k = c->k;
+    uint8_t j = c->j;
+    uint8_t sk = 0;
+    uint8_t sj = 0;
+    for (size_t i = 0; i < size; ++i) {
+        k++;
+        sk = s[k];
+        j += sk;
+        sj = s[j];
+        s[k] = sj;
+        s[j] = sk;
+    }
+    c->k = k;
+    c->j = j;
+    if (size > 0)
+        c->t = sk + sj;
 }
 
 void rc4_symmetric_enc_dec(uint8_t* data, const size_t size, const uint8_t* key, const size_t key_len) {
@@ -61,6 +98,70 @@ void rc4_symmetric_enc_dec(uint8_t* data, const size_t size, const uint8_t* key,
     rc4(&context, data, size);
 }
 
+// one keystream step for a lane; the lane state stays in locals so the stores through s can't
+// force j to be reloaded.
+#define RC4_LANE_STEP(s, j, k, sk, sj) \
+    sk = s[k]; \
+    j += sk; \
+    sj = s[j]; \
+    s[k] = sj; \
+    s[j] = sk
+
+void rc4_multi_keystream(const uint8_t* keys, const size_t key_len, const size_t count, const size_t offset, uint8_t* out, const size_t size) {
+    RC4_CONTEXT lanes[RC4_MULTI_LANES];
+    size_t n = 0;
+
+    // RC4 indexes its state with its own output, so it can't be vectorized. instead run several
+    // keys in one loop; k is the same for every key, and the lanes give the cpu independent
+    // loads and stores to overlap.
+    for (; n + RC4_MULTI_LANES <= count; n += RC4_MULTI_LANES) {
+        uint8_t* s0 = lanes[0].s;
+        uint8_t* s1 = lanes[1].s;
+        uint8_t* s2 = lanes[2].s;
+        uint8_t* s3 = lanes[3].s;
+        uint8_t* out0 = out + (n + 0) * size;
+        uint8_t* out1 = out + (n + 1) * size;
+        uint8_t* out2 = out + (n + 2) * size;
+        uint8_t* out3 = out + (n + 3) * size;
+        uint8_t j0 = 0, j1 = 0, j2 = 0, j3 = 0;
+        uint8_t sk0, sk1, sk2, sk3;
+        uint8_t sj0, sj1, sj2, sj3;
+        uint8_t k = 0;
+
+        for (int l = 0; l < RC4_MULTI_LANES; ++l) {
+            rc4_key(&lanes[l], keys + (n + l) * key_len, key_len);
+        }
+
+        for (size_t i = 0; i < offset; ++i) {
+            k++;
+            RC4_LANE_STEP(s0, j0, k, sk0, sj0);
+            RC4_LANE_STEP(s1, j1, k, sk1, sj1);
+            RC4_LANE_STEP(s2, j2, k, sk2, sj2);
+            RC4_LANE_STEP(s3, j3, k, sk3, sj3);
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            k++;
+            RC4_LANE_STEP(s0, j0, k, sk0, sj0);
+            RC4_LANE_STEP(s1, j1, k, sk1, sj1);
+            RC4_LANE_STEP(s2, j2, k, sk2, sj2);
+            RC4_LANE_STEP(s3, j3, k, sk3, sj3);
+            out0[i] = s0[(uint8_t)(sk0 + sj0)];
+            out1[i] = s1[(uint8_t)(sk1 + sj1)];
+            out2[i] = s2[(uint8_t)(sk2 + sj2)];
+            out3[i] = s3[(uint8_t)(sk3 + sj3)];
+        }
+    }
+
+    // remaining keys one at a time.
+    for (; n < count; ++n) {
+        rc4_key(&lanes[0], keys + n * key_len, key_len);
+        rc4_skip(&lanes[0], offset);
+        memset(out + n * size, 0, size);
+        rc4(&lanes[0], out + n * size, size);
+    }
+}
+
 inline void swap_byte(uint8_t* a, uint8_t* b) {
     uint8_t tmp = *a;
     *a = *b;
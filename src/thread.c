@@ -0,0 +1,99 @@
+// thread.c: minimal worker thread helpers
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+// std incl
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// user incl
+#include "thread.h"
+
+#ifdef MEM_TRACKING
+#include "mem_tracking.h"
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID arg) {
+	THREAD* thread = (THREAD*)arg;
+	thread->proc(thread->arg);
+	return 0;
+}
+#else
+static void* thread_entry(void* arg) {
+	THREAD* thread = (THREAD*)arg;
+	thread->proc(thread->arg);
+	return NULL;
+}
+#endif
+
+int thread_start(THREAD* thread, THREAD_PROC proc, void* arg) {
+	thread->proc = proc;
+	thread->arg = arg;
+	thread->handle = NULL;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+	if (thread->handle == NULL)
+		return 1;
+#else
+	pthread_t* handle = (pthread_t*)malloc(sizeof(pthread_t));
+	if (handle == NULL)
+		return 1;
+	if (pthread_create(handle, NULL, thread_entry, thread) != 0) {
+		free(handle);
+		return 1;
+	}
+	thread->handle = handle;
+#endif
+
+	return 0;
+}
+void thread_join(THREAD* thread) {
+	if (thread->handle == NULL)
+		return;
+
+#ifdef _WIN32
+	WaitForSingleObject((HANDLE)thread->handle, INFINITE);
+	CloseHandle((HANDLE)thread->handle);
+#else
+	pthread_join(*(pthread_t*)thread->handle, NULL);
+	free(thread->handle);
+#endif
+
+	thread->handle = NULL;
+}
+uint32_t thread_get_cpu_count() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (info.dwNumberOfProcessors > 0) ? info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (uint32_t)count : 1;
+#endif
+}
@@ -0,0 +1,980 @@
+// lzx_bench.c: LZX compression and decompression benchmark
+
+/* Copyright(C) 2024 tommojphillips
+ *
+ * This program is free software : you can redistribute it and /or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see < https://www.gnu.org/licenses/>.
+*/
+
+// Author: tommojphillips
+// GitHub: https:\\github.com\tommojphillips
+
+/* Times lzx_compress and lzx_decompress over a synthetic corpus generated at startup, checks every
+ stream round trips, and checks every stream is byte identical to the golden stream digests below.
+ Corrupted and truncated copies of every stream are also fed to the decoder; build with
+ -fsanitize=address to check malformed input stays in bounds. A stream with a match run past the end
+ of its frame is checked to decode on both decoders.
+ Every stream is also checked against the rest of the api: lzx_get_decompressed_size, lzx_decompress_mt,
+ lzx_decompress_range, lzx_compress_mt (digested as well), lzx_compress_fit, lzx_compress_incremental with
+ and without a checkpoint, and lzx_compress_fd / lzx_decompress_fd through temp files in the working
+ directory that are deleted afterwards. Every output is round tripped through lzx_decompress.
+ An encoder change that alters the bitstream fails the golden check; rerun with -update to print the
+ new digest table once the change in output is intended.
+
+ Build (Visual Studio): vc\lzx_bench.vcxproj
+ Build (gcc / clang):   cc -O2 -Iinc -DMEM_TRACKING tests/lzx_bench.c src/lzx_decoder.c src/lzx_encoder.c
+                           src/lzx_match.c src/lzx_e8.c src/sha1.c src/thread.c src/file.c src/mem_tracking.c -lpthread
+ MEM_TRACKING is optional; without it the allocation columns are not reported. */
+
+// std incl
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// user incl
+#include "lzx.h"
+#include "sha1.h"
+#include "file.h"
+
+#ifdef MEM_TRACKING
+#include "mem_tracking.h"
+#endif
+
+#define BENCH_DEFAULT_MIN_TIME 0.5  // seconds each measurement is repeated for
+#define BENCH_MIN_RUNS 3
+#define BENCH_CORRUPT_RUNS 32       // corrupted copies of each stream fed to the decoder
+#define BENCH_MT_THREADS 4          // fixed so the multi-threaded stream is the same on every machine
+#define BENCH_FD_NAME "lzx_bench_fd" // prefix of the files the fd round trip writes to the working directory
+
+typedef struct {
+	const char* name;
+	uint32_t size;
+	void (*generate)(uint8_t* buffer, uint32_t size, uint32_t seed);
+} BENCH_CORPUS;
+
+typedef struct {
+	const char* name;
+	int match_finder;
+	int level;
+} BENCH_CONFIG;
+
+typedef struct {
+	const char* corpus;
+	const char* config;
+	const char* digest;
+	const char* mt_digest;
+} BENCH_GOLDEN;
+
+typedef struct {
+	uint32_t compressed_size;
+	double compress_time;
+	double decompress_time;
+	long compress_allocations;
+	long decompress_allocations;
+	uint8_t digest[SHA1_DIGEST_LEN];
+	uint8_t mt_digest[SHA1_DIGEST_LEN];
+} BENCH_RESULT;
+
+/* deterministic generator; the corpus must be identical on every platform */
+static uint32_t rng_state;
+static void rng_seed(uint32_t seed) {
+	rng_state = seed ? seed : 0x2545F491;
+}
+static uint32_t rng_next() {
+	uint32_t x = rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng_state = x;
+	return x;
+}
+static uint32_t rng_range(uint32_t n) {
+	return rng_next() % n;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+/* x86-like code: functions with prologues and epilogues, register moves, stack loads, short jumps,
+ int3 padding, and E8 calls to a fixed set of function entry points so the e8 translation has work to do. */
+static void gen_code(uint8_t* buffer, uint32_t size, uint32_t seed) {
+	static const uint8_t ops[][3] = {
+		{ 0x8B, 0x45, 0x08 }, { 0x8B, 0x4D, 0x0C }, { 0x89, 0x45, 0xFC }, { 0x33, 0xC0, 0x00 },
+		{ 0x85, 0xC0, 0x00 }, { 0x50, 0x00, 0x00 }, { 0x51, 0x00, 0x00 }, { 0x56, 0x00, 0x00 },
+		{ 0x57, 0x00, 0x00 }, { 0x5E, 0x00, 0x00 }, { 0x5F, 0x00, 0x00 }, { 0x83, 0xC4, 0x08 },
+		{ 0x83, 0xEC, 0x10 }, { 0x8D, 0x45, 0xF0 }, { 0x3B, 0xC1, 0x00 }, { 0x0F, 0xB6, 0xC0 },
+	};
+	static const uint8_t op_len[] = { 3, 3, 3, 2, 2, 1, 1, 1, 1, 1, 1, 3, 3, 3, 2, 3 };
+	uint32_t functions[256];
+	uint32_t num_functions = 0;
+	uint32_t i = 0;
+
+	rng_seed(seed);
+	for (uint32_t j = 0; j < 256; j++)
+		functions[j] = rng_range(size);
+
+	while (i + 16 < size) {
+		// prologue
+		if (num_functions < 256)
+			functions[num_functions++] = i;
+		buffer[i++] = 0x55; buffer[i++] = 0x8B; buffer[i++] = 0xEC;
+
+		uint32_t body = 8 + rng_range(64);
+		while (body-- && i + 16 < size) {
+			uint32_t r = rng_range(16);
+			if (r < 3) {
+				// call rel32
+				uint32_t target = functions[rng_range(256)];
+				buffer[i] = 0xE8;
+				put_u32(buffer + i + 1, target - (i + 5));
+				i += 5;
+			}
+			else if (r < 5) {
+				// mov reg, imm32 / push imm32
+				buffer[i] = (r == 3) ? 0xB8 + (uint8_t)rng_range(8) : 0x68;
+				put_u32(buffer + i + 1, 0x80010000 + (rng_range(1024) << 4));
+				i += 5;
+			}
+			else if (r == 5) {
+				// jcc short
+				buffer[i++] = 0x74 + (uint8_t)rng_range(2);
+				buffer[i++] = (uint8_t)(2 + rng_range(32));
+			}
+			else {
+				uint32_t op = rng_range(16);
+				memcpy(buffer + i, ops[op], op_len[op]);
+				i += op_len[op];
+			}
+		}
+
+		// epilogue and alignment padding
+		buffer[i++] = 0x8B; buffer[i++] = 0xE5; buffer[i++] = 0x5D; buffer[i++] = 0xC3;
+		while ((i & 0xF) != 0 && i < size)
+			buffer[i++] = 0xCC;
+	}
+	while (i < size)
+		buffer[i++] = 0xCC;
+}
+
+/* long zero runs broken up by short records; section padding and bss in a kernel image */
+static void gen_zeros(uint8_t* buffer, uint32_t size, uint32_t seed) {
+	uint32_t i = 0;
+	rng_seed(seed);
+	memset(buffer, 0, size);
+	while (i < size) {
+		i += 256 + rng_range(8192);
+		uint32_t n = 4 + rng_range(60);
+		for (uint32_t j = 0; j < n && i < size; j++, i++)
+			buffer[i] = (uint8_t)rng_next();
+	}
+}
+
+/* incompressible data; exercises the uncompressed block path */
+static void gen_random(uint8_t* buffer, uint32_t size, uint32_t seed) {
+	rng_seed(seed);
+	for (uint32_t i = 0; i < size; i++)
+		buffer[i] = (uint8_t)(rng_next() >> 24);
+}
+
+/* text built from a small vocabulary; debug strings and resource text */
+static void gen_text(uint8_t* buffer, uint32_t size, uint32_t seed) {
+	static const char* words[] = {
+		"the", "kernel", "boot", "loader", "failed", "to", "initialize", "device", "memory", "error",
+		"status", "object", "handle", "invalid", "parameter", "buffer", "thread", "process", "system",
+		"driver", "irql", "dispatch", "level", "pool", "allocation", "page", "fault", "section", "image",
+		"xbox", "eeprom", "smbus", "video", "encoder", "flash", "rom", "hash", "signature", "key",
+	};
+	const uint32_t num_words = sizeof(words) / sizeof(words[0]);
+	uint32_t i = 0;
+	uint32_t words_in_line = 0;
+
+	rng_seed(seed);
+	while (i < size) {
+		const char* word = words[rng_range(num_words)];
+		uint32_t len = (uint32_t)strlen(word);
+		for (uint32_t j = 0; j < len && i < size; j++)
+			buffer[i++] = (uint8_t)word[j];
+		if (i < size) {
+			if (++words_in_line > 6 + rng_range(8)) {
+				buffer[i++] = rng_range(4) ? '\n' : 0;
+				words_in_line = 0;
+			}
+			else {
+				buffer[i++] = ' ';
+			}
+		}
+	}
+}
+
+/* a kernel image stand in: header, code, text, zero padding and a compressed blob */
+static void gen_kernel(uint8_t* buffer, uint32_t size, uint32_t seed) {
+	uint32_t header = 0x1000;
+	uint32_t code = size / 2;
+	uint32_t text = size / 8;
+	uint32_t blob = size / 16;
+	uint32_t zeros = size - header - code - text - blob;
+
+	gen_zeros(buffer, header, seed);
+	memcpy(buffer, "MZ", 2);
+	put_u32(buffer + 0x3C, 0x80);
+	memcpy(buffer + 0x80, "PE\0\0", 4);
+	gen_code(buffer + header, code, seed + 1);
+	gen_text(buffer + header + code, text, seed + 2);
+	gen_zeros(buffer + header + code + text, zeros, seed + 3);
+	gen_random(buffer + header + code + text + zeros, blob, seed + 4);
+}
+
+static const BENCH_CORPUS corpus_tbl[] = {
+	{ "code", 256 * 1024, gen_code },
+	{ "zeros", 256 * 1024, gen_zeros },
+	{ "random", 64 * 1024, gen_random },
+	{ "text", 128 * 1024, gen_text },
+	{ "kernel", 1024 * 1024, gen_kernel },
+	{ "tiny", 100, gen_random },
+	{ "byte", 1, gen_random },
+};
+
+static const BENCH_CONFIG config_tbl[] = {
+	{ "greedy-ht", LZX_MATCH_FINDER_HASH_TABLE, LZX_LEVEL_GREEDY },
+	{ "lazy-hc", LZX_MATCH_FINDER_HASH_CHAIN, LZX_LEVEL_LAZY },
+	{ "optimal-bt", LZX_MATCH_FINDER_BINARY_TREE, LZX_LEVEL_OPTIMAL },
+	{ "ultra-bt", LZX_MATCH_FINDER_BINARY_TREE, LZX_LEVEL_ULTRA },
+};
+
+/* SHA-1 of each compressed stream. regenerate with -update when the bitstream is meant to change */
+static const BENCH_GOLDEN golden_tbl[] = {
+	{ "code", "greedy-ht", "090b2619e7e6dddebdfe679cca76ca4a349625a7", "090b2619e7e6dddebdfe679cca76ca4a349625a7" },
+	{ "code", "lazy-hc", "d374a4f94e978e4c27f6b6f0da64df48effb76a9", "d374a4f94e978e4c27f6b6f0da64df48effb76a9" },
+	{ "code", "optimal-bt", "d50ef78319c2291d43344d27ea2998c360beb515", "d50ef78319c2291d43344d27ea2998c360beb515" },
+	{ "code", "ultra-bt", "00e43eb36b0816148c5bc4f1a312a06224169947", "00e43eb36b0816148c5bc4f1a312a06224169947" },
+	{ "zeros", "greedy-ht", "de21fd1d85d8b67a83a6d3a7aa2421cb1c3a483e", "de21fd1d85d8b67a83a6d3a7aa2421cb1c3a483e" },
+	{ "zeros", "lazy-hc", "770bd46af0f7c92c17f32e4daebcfc0d1367d22a", "770bd46af0f7c92c17f32e4daebcfc0d1367d22a" },
+	{ "zeros", "optimal-bt", "c8f8344d7343ab42766a763b4b070537fc66589e", "c8f8344d7343ab42766a763b4b070537fc66589e" },
+	{ "zeros", "ultra-bt", "c8f8344d7343ab42766a763b4b070537fc66589e", "c8f8344d7343ab42766a763b4b070537fc66589e" },
+	{ "random", "greedy-ht", "69c8390cfb34b77ea97d20278ca190d91b2131a8", "69c8390cfb34b77ea97d20278ca190d91b2131a8" },
+	{ "random", "lazy-hc", "278fd89c80a1fd97329d619bf92496ec2f2e2b55", "278fd89c80a1fd97329d619bf92496ec2f2e2b55" },
+	{ "random", "optimal-bt", "58cbfc6a5b5420d3add3981e70f5bd2d016ed70c", "58cbfc6a5b5420d3add3981e70f5bd2d016ed70c" },
+	{ "random", "ultra-bt", "58cbfc6a5b5420d3add3981e70f5bd2d016ed70c", "58cbfc6a5b5420d3add3981e70f5bd2d016ed70c" },
+	{ "text", "greedy-ht", "c0f37089eb81687f1f0175b317cadf9f49a53946", "c0f37089eb81687f1f0175b317cadf9f49a53946" },
+	{ "text", "lazy-hc", "f4947b39b74250539a5c99411931f3115429ba29", "f4947b39b74250539a5c99411931f3115429ba29" },
+	{ "text", "optimal-bt", "dae4744afb9400416052e364bb281531e8cbc20d", "dae4744afb9400416052e364bb281531e8cbc20d" },
+	{ "text", "ultra-bt", "bac3c1df808d5fe9b1dd682acecb4c7c9467362d", "bac3c1df808d5fe9b1dd682acecb4c7c9467362d" },
+	{ "kernel", "greedy-ht", "c4dec8730540501cb012c3181aa70f5f13363ffe", "b65176d0fb8e1c7514e672df73cfd899142bec45" },
+	{ "kernel", "lazy-hc", "3d3a6a109f1d3f49e7e5981935897b5571ca00ba", "9cffe026d5b4c271e207f294abd19f465ff79d89" },
+	{ "kernel", "optimal-bt", "77547f15c5d995213619951bb3eda339d7ac4a62", "6250b3863e9dc7c7f51d99df8ce9bb5313da873f" },
+	{ "kernel", "ultra-bt", "f445d1491ea283bdc339701920366573c70a6966", "fd63335271e25d9531e65e3effb7f227de553658" },
+	{ "tiny", "greedy-ht", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9" },
+	{ "tiny", "lazy-hc", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9" },
+	{ "tiny", "optimal-bt", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9" },
+	{ "tiny", "ultra-bt", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9", "633959007e5ee2fd82f33bf780b1f35ef3bc3ad9" },
+	{ "byte", "greedy-ht", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978" },
+	{ "byte", "lazy-hc", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978" },
+	{ "byte", "optimal-bt", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978" },
+	{ "byte", "ultra-bt", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978", "73e855801dc8aea8a2b8245dc886cc3c5f7ac978" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static double get_time() {
+#ifdef _WIN32
+	LARGE_INTEGER freq, counter;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static long get_allocations() {
+#ifdef MEM_TRACKING
+	return memtrack_totalAllocations;
+#else
+	return -1;
+#endif
+}
+
+static double get_mbps(uint32_t size, double seconds) {
+	if (seconds <= 0)
+		return 0;
+	return (double)size / (1024.0 * 1024.0) / seconds;
+}
+
+static void digest_to_str(const uint8_t digest[SHA1_DIGEST_LEN], char* str) {
+	for (int i = 0; i < SHA1_DIGEST_LEN; i++)
+		sprintf(str + i * 2, "%02x", digest[i]);
+}
+
+static const BENCH_GOLDEN* find_golden(const char* corpus, const char* config) {
+	for (uint32_t i = 0; golden_tbl[i].corpus != NULL; i++) {
+		if (strcmp(golden_tbl[i].corpus, corpus) == 0 && strcmp(golden_tbl[i].config, config) == 0)
+			return &golden_tbl[i];
+	}
+	return NULL;
+}
+
+static void sha1_digest(const uint8_t* buffer, uint32_t size, uint8_t digest[SHA1_DIGEST_LEN]) {
+	SHA1Context sha;
+	SHA1Reset(&sha);
+	SHA1Input(&sha, buffer, size);
+	SHA1Result(&sha, digest);
+}
+
+static uint8_t* load_file(const char* path, uint32_t* size) {
+	FILE* file = fopen(path, "rb");
+	uint8_t* buffer = NULL;
+	long len = 0;
+
+	if (file == NULL)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if (len > 0) {
+		buffer = (uint8_t*)malloc(len);
+		if (buffer != NULL && fread(buffer, 1, len, file) != (size_t)len) {
+			free(buffer);
+			buffer = NULL;
+		}
+	}
+
+	fclose(file);
+	*size = (uint32_t)len;
+	return buffer;
+}
+
+/* decompress corrupted copies of a stream: single bit flips, smashed bytes and truncations. a
+ corrupted stream may decode or fail, but must not crash or read out of bounds (run under ASan or
+ a debug heap to catch that); a truncated stream must fail.
+ returns the number of truncated streams that decoded */
+static int bench_corrupt(const uint8_t* compressed, uint32_t compressed_size, uint32_t src_size) {
+	uint8_t* corrupt = NULL;
+	uint8_t* decompressed = NULL;
+	uint32_t decompressed_size = 0;
+	uint32_t size = 0;
+	uint32_t corrupt_size = 0;
+	int failures = 0;
+
+	corrupt = (uint8_t*)malloc(compressed_size);
+	if (corrupt == NULL)
+		return 1;
+
+	rng_seed(compressed_size ^ src_size);
+	for (int i = 0; i < BENCH_CORRUPT_RUNS * 3; i++) {
+		memcpy(corrupt, compressed, compressed_size);
+		corrupt_size = compressed_size;
+
+		switch (i % 3) {
+			case 0: // bit flip
+				corrupt[rng_range(compressed_size)] ^= (uint8_t)(1 << rng_range(8));
+				break;
+			case 1: // byte smash
+				for (uint32_t n = 1 + rng_range(8); n > 0; n--)
+					corrupt[rng_range(compressed_size)] = (uint8_t)rng_next();
+				break;
+			case 2: // truncation; an empty stream is a valid stream
+				if (compressed_size < 2)
+					continue;
+				corrupt_size = 1 + rng_range(compressed_size - 1);
+				break;
+		}
+
+		decompressed = NULL;
+		size = lzx_decompress_bound(src_size);
+		if (lzx_decompress(corrupt, corrupt_size, &decompressed, &size, &decompressed_size) == 0 && (i % 3) == 2) {
+			printf("\nError: stream truncated to %u of %u bytes decoded\n", corrupt_size, compressed_size);
+			failures++;
+		}
+		if (decompressed != NULL)
+			free(decompressed);
+
+		lzx_get_decompressed_size(corrupt, corrupt_size, &decompressed_size);
+	}
+
+	free(corrupt);
+	return failures;
+}
+
+/* "0123456789" repeated, encoded so every frame ends on a match (lzx_compress stops a match one byte
+ short of the frame end). the first frame holds the trees, every full frame after it is a run of
+ repeated matches */
+#define OVERRUN_FULL_FRAMES 7
+#define OVERRUN_LAST_FRAME 1000
+#define OVERRUN_SHIFT 100
+static const uint8_t overrun_first_frame[] = {
+	0x5b, 0x80, 0x80, 0x8d, 0x38, 0x10, 0x83, 0x3e, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x20,
+	0x3b, 0x02, 0xc1, 0x7b, 0xfd, 0x56, 0xf6, 0xfb, 0x80, 0x30, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00,
+	0x19, 0x02, 0x27, 0x06, 0x0e, 0xdf, 0x7e, 0xbf, 0xf0, 0xfd, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00,
+	0x33, 0x00, 0x20, 0x33, 0xff, 0x7e, 0x3a, 0x99, 0xfb, 0x15, 0x26, 0xb2, 0xb7, 0x36, 0xfb, 0xce,
+	0x35, 0xf1, 0x00, 0x78, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x80, 0x01,
+};
+static const uint8_t overrun_full_frame[] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+	0x00, 0x00,
+};
+static const uint8_t overrun_last_frame[] = { 0xc0, 0x01 };
+
+/* move the last frame boundary of the overrun stream back into the match that ends on it; the
+ match then runs past the end of its frame and the decoder must carry it into the last frame.
+ returns 0 if the single thread decoder and the pipeline both reproduce the input */
+static int bench_overrun() {
+	const uint32_t src_size = OVERRUN_FULL_FRAMES * LZX_CHUNK_SIZE + OVERRUN_LAST_FRAME;
+	uint8_t* src = NULL;
+	uint8_t* compressed = NULL;
+	uint8_t* decompressed = NULL;
+	uint32_t compressed_size = 0;
+	uint32_t decompressed_size = 0;
+	uint32_t size = 0;
+	int failures = 0;
+
+	src = (uint8_t*)malloc(src_size);
+	compressed = (uint8_t*)malloc(OVERRUN_FULL_FRAMES * (sizeof(LZX_BLOCK) + sizeof(overrun_full_frame)) + sizeof(overrun_first_frame) + sizeof(overrun_last_frame) + sizeof(LZX_BLOCK));
+	if (src == NULL || compressed == NULL) {
+		printf("\nError: out of memory\n");
+		failures++;
+		goto Cleanup;
+	}
+
+	for (uint32_t i = 0; i < src_size; i++)
+		src[i] = (uint8_t)('0' + i % 10);
+
+	for (uint32_t i = 0; i < OVERRUN_FULL_FRAMES + 1; i++) {
+		LZX_BLOCK* block = (LZX_BLOCK*)(compressed + compressed_size);
+		const uint8_t* frame = overrun_full_frame;
+		block->compressed_size = sizeof(overrun_full_frame);
+		block->uncompressed_size = LZX_CHUNK_SIZE;
+		if (i == 0) {
+			frame = overrun_first_frame;
+			block->compressed_size = sizeof(overrun_first_frame);
+		}
+		if (i == OVERRUN_FULL_FRAMES - 1) {
+			block->uncompressed_size -= OVERRUN_SHIFT;
+		}
+		if (i == OVERRUN_FULL_FRAMES) {
+			frame = overrun_last_frame;
+			block->compressed_size = sizeof(overrun_last_frame);
+			block->uncompressed_size = OVERRUN_LAST_FRAME + OVERRUN_SHIFT;
+		}
+		memcpy(compressed + compressed_size + sizeof(LZX_BLOCK), frame, block->compressed_size);
+		compressed_size += sizeof(LZX_BLOCK) + block->compressed_size;
+	}
+
+	for (uint32_t threads = 1; threads <= 2; threads++) {
+		if (decompressed != NULL) {
+			free(decompressed);
+			decompressed = NULL;
+		}
+		size = lzx_decompress_bound(src_size);
+		if (lzx_decompress_mt(compressed, compressed_size, &decompressed, &size, &decompressed_size, threads) != 0 ||
+			decompressed_size != src_size || memcmp(decompressed, src, src_size) != 0) {
+			printf("\nError: a match run past the end of the frame did not decode (%u thread(s))\n", threads);
+			failures++;
+		}
+	}
+
+Cleanup:
+	if (src != NULL) {
+		free(src);
+	}
+	if (compressed != NULL) {
+		free(compressed);
+	}
+	if (decompressed != NULL) {
+		free(decompressed);
+	}
+	return failures;
+}
+
+/* decode a stream with lzx_decompress and compare it with the input.
+ returns 0 if it round trips */
+static int check_round_trip(const char* name, const uint8_t* compressed, uint32_t compressed_size, const uint8_t* src, uint32_t src_size) {
+	uint8_t* decompressed = NULL;
+	uint32_t decompressed_size = 0;
+	uint32_t size = lzx_decompress_bound(src_size);
+	int failures = 0;
+
+	if (lzx_decompress(compressed, compressed_size, &decompressed, &size, &decompressed_size) != 0 ||
+		decompressed_size != src_size || memcmp(decompressed, src, src_size) != 0) {
+		printf("\nError: %s round trip mismatch\n", name);
+		failures++;
+	}
+
+	if (decompressed != NULL) {
+		free(decompressed);
+	}
+	return failures;
+}
+
+/* compress and decompress through the file descriptor api; the files are written to the working
+ directory and deleted afterwards.
+ returns 0 if the stream round trips both ways */
+static int bench_fd(const uint8_t* src, uint32_t src_size, const LZX_COMPRESSION_PARAMS* params) {
+	const char* src_name = BENCH_FD_NAME ".in";
+	const char* lzx_name = BENCH_FD_NAME ".lzx";
+	const char* out_name = BENCH_FD_NAME ".out";
+	uint8_t* compressed = NULL;
+	uint8_t* decompressed = NULL;
+	uint32_t compressed_size = 0;
+	uint32_t decompressed_size = 0;
+	uint32_t read_size = 0;
+	uint32_t written_size = 0;
+	FILE* file = NULL;
+	int in_fd = -1;
+	int out_fd = -1;
+	int result = 1;
+	int failures = 0;
+
+	file = fopen(src_name, "wb");
+	if (file == NULL || fwrite(src, 1, src_size, file) != src_size) {
+		printf("\nError: could not write %s\n", src_name);
+		if (file != NULL)
+			fclose(file);
+		failures++;
+		goto Cleanup;
+	}
+	fclose(file);
+
+	in_fd = openFileFd(src_name, false);
+	out_fd = openFileFd(lzx_name, true);
+	if (in_fd != -1 && out_fd != -1)
+		result = lzx_compress_fd(in_fd, out_fd, params, &read_size, &written_size);
+	closeFileFd(in_fd);
+	closeFileFd(out_fd);
+
+	compressed = load_file(lzx_name, &compressed_size);
+	if (result != 0 || read_size != src_size || compressed == NULL || compressed_size != written_size) {
+		printf("\nError: lzx_compress_fd failed\n");
+		failures++;
+		goto Cleanup;
+	}
+	failures += check_round_trip("lzx_compress_fd", compressed, compressed_size, src, src_size);
+
+	result = 1;
+	in_fd = openFileFd(lzx_name, false);
+	out_fd = openFileFd(out_name, true);
+	if (in_fd != -1 && out_fd != -1)
+		result = lzx_decompress_fd(in_fd, out_fd, &read_size, &written_size);
+	closeFileFd(in_fd);
+	closeFileFd(out_fd);
+
+	decompressed = load_file(out_name, &decompressed_size);
+	if (result != 0 || read_size != compressed_size || written_size != src_size ||
+		decompressed == NULL || decompressed_size != src_size || memcmp(decompressed, src, src_size) != 0) {
+		printf("\nError: lzx_decompress_fd round trip mismatch\n");
+		failures++;
+	}
+
+Cleanup:
+	deleteFile(src_name);
+	deleteFile(lzx_name);
+	deleteFile(out_name);
+	if (compressed != NULL) {
+		free(compressed);
+	}
+	if (decompressed != NULL) {
+		free(decompressed);
+	}
+	return failures;
+}
+
+/* run a stream through the rest of the api: the decoders are checked against the input, the
+ encoders are checked to round trip through lzx_decompress. the multi-threaded stream is digested
+ for the golden check.
+ returns the number of failed checks */
+static int bench_api(const uint8_t* src, uint32_t src_size, const uint8_t* compressed, uint32_t compressed_size, const LZX_COMPRESSION_PARAMS* params, BENCH_RESULT* result) {
+	uint8_t* stream = NULL;
+	uint8_t* decompressed = NULL;
+	uint8_t* checkpoint = NULL;
+	uint8_t* new_checkpoint = NULL;
+	uint8_t* changed = NULL;
+	uint32_t stream_size = 0;
+	uint32_t decompressed_size = 0;
+	uint32_t checkpoint_size = 0;
+	uint32_t new_checkpoint_size = 0;
+	uint32_t reused_size = 0;
+	uint32_t size = 0;
+	int failures = 0;
+
+	// the frame headers give the size without decoding.
+	if (lzx_get_decompressed_size(compressed, compressed_size, &decompressed_size) != 0 || decompressed_size != src_size) {
+		printf("\nError: lzx_get_decompressed_size returned %u of %u\n", decompressed_size, src_size);
+		failures++;
+	}
+
+	// the pipeline decoder.
+	size = lzx_decompress_bound(src_size);
+	if (lzx_decompress_mt(compressed, compressed_size, &decompressed, &size, &decompressed_size, 2) != 0 ||
+		decompressed_size != src_size || memcmp(decompressed, src, src_size) != 0) {
+		printf("\nError: lzx_decompress_mt round trip mismatch\n");
+		failures++;
+	}
+
+	// the first frame, a range across a frame boundary in the middle, the last byte, and a range past the end.
+	{
+		const uint32_t middle = (src_size / 2) & ~(LZX_CHUNK_SIZE - 1);
+		const uint32_t start = (middle > 100) ? middle - 100 : 0;
+		const uint32_t ranges[3][2] = {
+			{ 0, (src_size < LZX_CHUNK_SIZE) ? src_size : LZX_CHUNK_SIZE },
+			{ start, (src_size - start < 200) ? src_size - start : 200 },
+			{ src_size - 1, 1 },
+		};
+		for (int i = 0; i < 3; i++) {
+			if (lzx_decompress_range(compressed, compressed_size, ranges[i][0], ranges[i][1], decompressed) != 0 ||
+				memcmp(decompressed, src + ranges[i][0], ranges[i][1]) != 0) {
+				printf("\nError: lzx_decompress_range %u + %u mismatch\n", ranges[i][0], ranges[i][1]);
+				failures++;
+			}
+		}
+		if (lzx_decompress_range(compressed, compressed_size, src_size, 1, decompressed) != LZX_ERROR_BUFFER_OVERFLOW) {
+			printf("\nError: lzx_decompress_range past the end did not fail\n");
+			failures++;
+		}
+	}
+
+	// the multi-threaded encoder.
+	size = lzx_compress_bound(src_size);
+	if (lzx_compress_mt(src, src_size, &stream, &size, &stream_size, params, BENCH_MT_THREADS) != 0) {
+		printf("\nError: lzx_compress_mt failed\n");
+		failures++;
+	}
+	else {
+		sha1_digest(stream, stream_size, result->mt_digest);
+		failures += check_round_trip("lzx_compress_mt", stream, stream_size, src, src_size);
+	}
+	free(stream);
+	stream = NULL;
+
+	// the parameter search; the base parameters fit, so it stops after the first batch.
+	if (lzx_compress_fit(src, src_size, &stream, &stream_size, params, compressed_size, 2) != 0 || stream_size > compressed_size) {
+		printf("\nError: lzx_compress_fit did not fit %u bytes\n", compressed_size);
+		failures++;
+	}
+	else {
+		failures += check_round_trip("lzx_compress_fit", stream, stream_size, src, src_size);
+	}
+	free(stream);
+	stream = NULL;
+
+	// the incremental encoder; change the last byte, then recompress with the checkpoint of the first run.
+	changed = (uint8_t*)malloc(src_size);
+	if (changed == NULL ||
+		lzx_compress_incremental(src, src_size, &stream, &stream_size, params, NULL, 0, &checkpoint, &checkpoint_size, NULL, 2) != 0) {
+		printf("\nError: lzx_compress_incremental failed\n");
+		failures++;
+		goto Cleanup;
+	}
+	failures += check_round_trip("lzx_compress_incremental", stream, stream_size, src, src_size);
+	free(stream);
+	stream = NULL;
+
+	memcpy(changed, src, src_size);
+	changed[src_size - 1] ^= 0xFF;
+	if (lzx_compress_incremental(changed, src_size, &stream, &stream_size, params, checkpoint, checkpoint_size, &new_checkpoint, &new_checkpoint_size, &reused_size, 2) != 0) {
+		printf("\nError: lzx_compress_incremental with a checkpoint failed\n");
+		failures++;
+		goto Cleanup;
+	}
+	if (src_size > LZX_WINDOW_SIZE && reused_size == 0) {
+		printf("\nError: lzx_compress_incremental reused nothing from the checkpoint\n");
+		failures++;
+	}
+	failures += check_round_trip("lzx_compress_incremental checkpoint", stream, stream_size, changed, src_size);
+
+	failures += bench_fd(src, src_size, params);
+
+Cleanup:
+	if (stream != NULL) {
+		free(stream);
+	}
+	if (decompressed != NULL) {
+		free(decompressed);
+	}
+	if (checkpoint != NULL) {
+		free(checkpoint);
+	}
+	if (new_checkpoint != NULL) {
+		free(new_checkpoint);
+	}
+	if (changed != NULL) {
+		free(changed);
+	}
+	return failures;
+}
+
+/* compress and decompress the buffer until min_time has passed; keeps the fastest run of each.
+ returns 0 if every decompressed buffer matched the input */
+static int bench_one(const uint8_t* src, uint32_t src_size, const LZX_COMPRESSION_PARAMS* params, double min_time, BENCH_RESULT* result) {
+	uint8_t* compressed = NULL;
+	uint8_t* decompressed = NULL;
+	uint32_t compressed_size = 0;
+	uint32_t decompressed_size = 0;
+	uint32_t size = 0;
+	double start = 0;
+	double t = 0;
+	double total = 0;
+	long allocations = 0;
+	int runs = 0;
+	int result_code = 1;
+
+	memset(result, 0, sizeof(BENCH_RESULT));
+	result->compress_time = 1e9;
+	result->decompress_time = 1e9;
+
+	for (runs = 0, total = 0; runs < BENCH_MIN_RUNS || total < min_time; runs++) {
+		if (compressed != NULL) {
+			free(compressed);
+			compressed = NULL;
+		}
+		size = lzx_compress_bound(src_size);
+		allocations = get_allocations();
+		start = get_time();
+		if (lzx_compress(src, src_size, &compressed, &size, &compressed_size, params) != 0) {
+			printf("\nError: lzx_compress failed\n");
+			goto Cleanup;
+		}
+		t = get_time() - start;
+		result->compress_allocations = allocations < 0 ? -1 : get_allocations() - allocations - 1; // minus the output buffer
+		if (t < result->compress_time)
+			result->compress_time = t;
+		total += t;
+	}
+	result->compressed_size = compressed_size;
+
+	sha1_digest(compressed, compressed_size, result->digest);
+
+	for (runs = 0, total = 0; runs < BENCH_MIN_RUNS || total < min_time; runs++) {
+		if (decompressed != NULL) {
+			free(decompressed);
+			decompressed = NULL;
+		}
+		size = lzx_decompress_bound(src_size);
+		allocations = get_allocations();
+		start = get_time();
+		if (lzx_decompress(compressed, compressed_size, &decompressed, &size, &decompressed_size) != 0) {
+			printf("\nError: lzx_decompress failed\n");
+			goto Cleanup;
+		}
+		t = get_time() - start;
+		result->decompress_allocations = allocations < 0 ? -1 : get_allocations() - allocations - 1;
+		if (t < result->decompress_time)
+			result->decompress_time = t;
+		total += t;
+	}
+
+	if (decompressed_size != src_size || memcmp(decompressed, src, src_size) != 0) {
+		printf("\nError: round trip mismatch\n");
+		goto Cleanup;
+	}
+
+	if (bench_corrupt(compressed, compressed_size, src_size) != 0)
+		goto Cleanup;
+
+	if (bench_api(src, src_size, compressed, compressed_size, params, result) != 0)
+		goto Cleanup;
+
+	result_code = 0;
+
+Cleanup:
+	if (compressed != NULL) {
+		free(compressed);
+	}
+	if (decompressed != NULL) {
+		free(decompressed);
+	}
+	return result_code;
+}
+
+static void print_usage() {
+	printf("Usage: lzx_bench [-time <seconds>] [-corpus <name>] [-config <name>] [-file <path>] [-update]\n\n"
+		" -time <seconds>  Minimum time each measurement is repeated for (default %.1f)\n"
+		" -corpus <name>   Only run the named corpus\n"
+		" -config <name>   Only run the named compression config\n"
+		" -file <path>     Benchmark a file (e.g. a kernel image) as well; no golden check\n"
+		" -update          Print the golden digest table for the current encoder\n\n",
+		BENCH_DEFAULT_MIN_TIME);
+
+	printf("Corpora: ");
+	for (uint32_t i = 0; i < sizeof(corpus_tbl) / sizeof(corpus_tbl[0]); i++)
+		printf("%s ", corpus_tbl[i].name);
+	printf("\nConfigs: ");
+	for (uint32_t i = 0; i < sizeof(config_tbl) / sizeof(config_tbl[0]); i++)
+		printf("%s ", config_tbl[i].name);
+	printf("\n");
+}
+
+static void print_result(const char* corpus, const char* config, uint32_t src_size, const BENCH_RESULT* result, const char* check) {
+	printf("%-8s %-11s %9u %9u %6.2f%% %9.2f %9.2f",
+		corpus, config, src_size, result->compressed_size,
+		100.0 * result->compressed_size / src_size,
+		get_mbps(src_size, result->compress_time),
+		get_mbps(src_size, result->decompress_time));
+
+	if (result->compress_allocations < 0)
+		printf(" %7s %7s", "-", "-");
+	else
+		printf(" %7ld %7ld", result->compress_allocations, result->decompress_allocations);
+
+	printf("  %s\n", check);
+}
+
+int main(int argc, char** argv) {
+	const char* only_corpus = NULL;
+	const char* only_config = NULL;
+	const char* file_path = NULL;
+	double min_time = BENCH_DEFAULT_MIN_TIME;
+	bool update = false;
+	int failures = 0;
+	char digest_str[SHA1_DIGEST_LEN * 2 + 1];
+	char mt_digest_str[SHA1_DIGEST_LEN * 2 + 1];
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+			min_time = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-corpus") == 0 && i + 1 < argc) {
+			only_corpus = argv[++i];
+		}
+		else if (strcmp(argv[i], "-config") == 0 && i + 1 < argc) {
+			only_config = argv[++i];
+		}
+		else if (strcmp(argv[i], "-file") == 0 && i + 1 < argc) {
+			file_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "-update") == 0) {
+			update = true;
+			min_time = 0;
+		}
+		else {
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (!update) {
+		printf("%-8s %-11s %9s %9s %7s %9s %9s %7s %7s  %s\n",
+			"corpus", "config", "size", "packed", "ratio", "comp MB/s", "dec MB/s", "c-alloc", "d-alloc", "check");
+	}
+
+	for (uint32_t i = 0; i < sizeof(corpus_tbl) / sizeof(corpus_tbl[0]); i++) {
+		const BENCH_CORPUS* corpus = &corpus_tbl[i];
+		if (only_corpus != NULL && strcmp(only_corpus, corpus->name) != 0)
+			continue;
+
+		uint8_t* src = (uint8_t*)malloc(corpus->size);
+		if (src == NULL) {
+			printf("Error: out of memory\n");
+			return 1;
+		}
+		corpus->generate(src, corpus->size, 0x58424F58 + i);
+
+		for (uint32_t j = 0; j < sizeof(config_tbl) / sizeof(config_tbl[0]); j++) {
+			const BENCH_CONFIG* config = &config_tbl[j];
+			if (only_config != NULL && strcmp(only_config, config->name) != 0)
+				continue;
+
+			LZX_COMPRESSION_PARAMS params;
+			lzx_init_compression_params(&params);
+			params.match_finder = config->match_finder;
+			params.level = config->level;
+
+			BENCH_RESULT result;
+			if (bench_one(src, corpus->size, &params, min_time, &result) != 0) {
+				printf("%-8s %-11s FAILED\n", corpus->name, config->name);
+				failures++;
+				continue;
+			}
+
+			digest_to_str(result.digest, digest_str);
+			digest_to_str(result.mt_digest, mt_digest_str);
+			if (update) {
+				printf("\t{ \"%s\", \"%s\", \"%s\", \"%s\" },\n", corpus->name, config->name, digest_str, mt_digest_str);
+				continue;
+			}
+
+			const BENCH_GOLDEN* golden = find_golden(corpus->name, config->name);
+			const char* check = "ok";
+			if (golden == NULL) {
+				check = "ok (no golden)";
+			}
+			else if (strcmp(golden->digest, digest_str) != 0 || strcmp(golden->mt_digest, mt_digest_str) != 0) {
+				check = "GOLDEN MISMATCH";
+				failures++;
+			}
+			print_result(corpus->name, config->name, corpus->size, &result, check);
+		}
+
+		free(src);
+	}
+
+	if (file_path != NULL && !update) {
+		uint32_t size = 0;
+		uint8_t* src = load_file(file_path, &size);
+		if (src == NULL) {
+			printf("Error: could not read %s\n", file_path);
+			return 1;
+		}
+		for (uint32_t j = 0; j < sizeof(config_tbl) / sizeof(config_tbl[0]); j++) {
+			const BENCH_CONFIG* config = &config_tbl[j];
+			if (only_config != NULL && strcmp(only_config, config->name) != 0)
+				continue;
+
+			LZX_COMPRESSION_PARAMS params;
+			lzx_init_compression_params(&params);
+			params.match_finder = config->match_finder;
+			params.level = config->level;
+
+			BENCH_RESULT result;
+			if (bench_one(src, size, &params, min_time, &result) != 0) {
+				printf("%-8s %-11s FAILED\n", "file", config->name);
+				failures++;
+				continue;
+			}
+			print_result("file", config->name, size, &result, "ok");
+		}
+		free(src);
+	}
+
+	if (!update && bench_overrun() != 0) {
+		printf("%-8s %-11s FAILED\n", "overrun", "-");
+		failures++;
+	}
+
+	if (!update) {
+		printf("\n%s: %d failure(s)\n", failures ? "FAILED" : "PASSED", failures);
+	}
+
+#ifdef MEM_TRACKING
+	if (memtrack_report() != 0)
+		failures++;
+#endif
+
+	return failures ? 1 : 0;
+}